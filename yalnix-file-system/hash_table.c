@@ -21,6 +21,7 @@
  * error.
  */
 #include "hash_table.h"
+#include "trace.h"
 
 /*
  * Requires:
@@ -183,7 +184,7 @@ hash_table_resize(struct hash_table *ht, unsigned int new_size)
      */
     free(ht->head);
     ht->head = new_head;
-    TracePrintf(1, "WARNING: hash table is getting resized from %d to %d\n",
+    TRACE_CACHE(2, "WARNING: hash table is getting resized from %d to %d\n",
         ht->size, new_size);
     ht->size = new_size;
     return (0);
@@ -214,7 +215,7 @@ hash_table_insert(struct hash_table *ht, int key, void *value)
         /*
          * Try to double the number of collision chains.
          */
-        TracePrintf(1, "WARNING: hash table about to resize\n");
+        TRACE_CACHE(2, "WARNING: hash table about to resize\n");
         if (hash_table_resize(ht, ht->size * 2) == -1)
             return (-1);
     }
@@ -328,7 +329,7 @@ hash_table_remove(struct hash_table *ht, int key,
         void *(*destructor)(int key, void *value, void *cookie),
         void *cookie)
 {
-    hash_table_mapping *elem, *prev;
+    hash_table_mapping *elem, *prev = NULL;
     unsigned int index;
 
     /*
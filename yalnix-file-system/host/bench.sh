@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+#	Run each named test program as the client of a host build of
+#	the YFS server, each on a freshly made DISK in its own scratch
+#	directory, and report its wall-clock time together with the
+#	disk and message counters printed by the server on exit, and
+#	the block and name cache hits and misses, the attribute leases
+#	renewed and refused, and the average extent length of the blocks
+#	it allocated, which it traces at shutdown.
+#
+#	Usage: bench.sh build_dir test ...
+#
+#	Options for the server, such as "-c 2q" or "-r 16", are taken from
+#	YFS_FLAGS.
+#
+#	Exits non-zero if any server does not exit cleanly.
+#
+
+BUILD=$(cd "$1" && pwd)
+shift
+SCRATCH=$(mktemp -d)
+STATUS=0
+
+printf "%-32s %8s  %s\n" "test" "ms" "server counters"
+for TEST in "$@"; do
+	DIR="$SCRATCH/$TEST"
+	mkdir -p "$DIR"
+	cd "$DIR" || exit 1
+	"$BUILD/mkyfs" > /dev/null
+	START=$(date +%s%N)
+	YFS_HOST_STATS=1 timeout 60 "$BUILD/yfs" $YFS_FLAGS "$BUILD/$TEST" \
+	    > "$DIR/output" 2> "$DIR/stats"
+	RESULT=$?
+	END=$(date +%s%N)
+	COUNTERS=$(grep '^host:' "$DIR/stats" | sed 's/^host: //')
+	CACHE=$(grep 'block cache' "$DIR/TRACE" 2> /dev/null | sed 's/.*: //')
+	[ -n "$CACHE" ] && COUNTERS="$COUNTERS, $CACHE"
+	NAMES=$(grep 'name cache' "$DIR/TRACE" 2> /dev/null | sed 's/.*: //')
+	[ -n "$NAMES" ] && COUNTERS="$COUNTERS, $NAMES"
+	ALLOC=$(grep 'block allocation' "$DIR/TRACE" 2> /dev/null | sed 's/.*, //')
+	[ -n "$ALLOC" ] && COUNTERS="$COUNTERS, $ALLOC"
+	if [ $RESULT -ne 0 ]; then
+		COUNTERS="FAILED with status $RESULT"
+		STATUS=1
+	fi
+	printf "%-32s %8d  %s\n" "$TEST" $(((END - START) / 1000000)) "$COUNTERS"
+done
+
+if [ $STATUS -ne 0 ]; then
+	echo "output of failed tests kept in $SCRATCH"
+else
+	rm -rf "$SCRATCH"
+fi
+exit $STATUS
@@ -0,0 +1,61 @@
+/*
+ * Host stand-in for the Yalnix <comp421/filesystem.h>.
+ *
+ * Defines the on-disk format of the Yalnix file system exactly as the
+ * course header does, so that DISK images made by mkyfs are usable by
+ * the host build of the server unchanged.
+ */
+
+#ifndef _HOST_COMP421_FILESYSTEM_H
+#define _HOST_COMP421_FILESYSTEM_H
+
+#include <comp421/hardware.h>
+
+#define BLOCKSIZE           SECTORSIZE
+#define NUM_DIRECT          12
+#define INODESIZE           64
+#define DIRNAMELEN          30
+#define MAXPATHNAMELEN      256
+#define MAXSYMLINKS         20
+#define ROOTINODE           1
+
+/* Inode types. */
+#define INODE_FREE          0
+#define INODE_DIRECTORY     1
+#define INODE_REGULAR       2
+#define INODE_SYMLINK       3
+
+/* Cache sizes for the file server. */
+#define BLOCK_CACHESIZE     32
+#define INODE_CACHESIZE     16
+
+/* Service id the file server registers under. */
+#define FILE_SERVER         1
+
+/* Maximum number of files open at once in one process. */
+#define MAX_OPEN_FILES      16
+
+/* Header stored in the first inode slot of block 1. */
+struct fs_header {
+    int num_blocks;
+    int num_inodes;
+    char padding[56];
+};
+
+/* On-disk inode. */
+struct inode {
+    short type;
+    short nlink;
+    int reuse;
+    int size;
+    int direct[NUM_DIRECT];
+    int indirect;
+};
+
+/* On-disk directory entry. */
+struct dir_entry {
+    short inum;
+    char name[DIRNAMELEN];
+};
+
+#endif /* _HOST_COMP421_FILESYSTEM_H */
@@ -0,0 +1,19 @@
+/*
+ * Host stand-in for the Yalnix <comp421/hardware.h>.
+ *
+ * Only the pieces of the simulated hardware that the YFS server, the
+ * library and the test programs rely on are reproduced here: the disk
+ * geometry and the TracePrintf debugging interface.
+ */
+
+#ifndef _HOST_COMP421_HARDWARE_H
+#define _HOST_COMP421_HARDWARE_H
+
+/* Disk geometry of the simulated Yalnix disk. */
+#define SECTORSIZE      512
+#define NUMSECTORS      1426
+
+/* Print a debugging message to the TRACE file if level <= trace level. */
+extern void TracePrintf(int level, char *fmt, ...);
+
+#endif /* _HOST_COMP421_HARDWARE_H */
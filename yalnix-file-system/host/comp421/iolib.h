@@ -0,0 +1,39 @@
+/*
+ * Host stand-in for the Yalnix <comp421/iolib.h>.
+ *
+ * Declares the file system library interface implemented by iolib.c.
+ */
+
+#ifndef _HOST_COMP421_IOLIB_H
+#define _HOST_COMP421_IOLIB_H
+
+#define SEEK_SET    0
+#define SEEK_CUR    1
+#define SEEK_END    2
+
+/* File information returned by Stat. */
+struct Stat {
+    int inum;
+    int type;
+    int size;
+    int nlink;
+};
+
+extern int Open(char *);
+extern int Close(int);
+extern int Create(char *);
+extern int Read(int, void *, int);
+extern int Write(int, void *, int);
+extern int Seek(int, int, int);
+extern int Link(char *, char *);
+extern int Unlink(char *);
+extern int SymLink(char *, char *);
+extern int ReadLink(char *, char *, int);
+extern int MkDir(char *);
+extern int RmDir(char *);
+extern int ChDir(char *);
+extern int Stat(char *, struct Stat *);
+extern int Sync(void);
+extern int Shutdown(void);
+
+#endif /* _HOST_COMP421_IOLIB_H */
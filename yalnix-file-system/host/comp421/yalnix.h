@@ -0,0 +1,35 @@
+/*
+ * Host stand-in for the Yalnix <comp421/yalnix.h>.
+ *
+ * Declares the subset of Yalnix kernel calls used by the YFS server,
+ * the library and the test programs. They are implemented for Linux
+ * in host/yalnix.c.
+ */
+
+#ifndef _HOST_COMP421_YALNIX_H
+#define _HOST_COMP421_YALNIX_H
+
+#include <comp421/hardware.h>
+
+#define ERROR           (-1)
+
+/* Process management. */
+extern int Fork(void);
+extern int Exec(char *, char **);
+extern void Exit(int) __attribute__((noreturn));
+extern int GetPid(void);
+extern int Delay(int);
+
+/* Interprocess communication. */
+extern int Register(unsigned int);
+extern int Send(void *, int);
+extern int Receive(void *);
+extern int Reply(void *, int);
+extern int CopyFrom(int, void *, void *, int);
+extern int CopyTo(int, void *, void *, int);
+
+/* Disk access. */
+extern int ReadSector(int, void *);
+extern int WriteSector(int, void *);
+
+#endif /* _HOST_COMP421_YALNIX_H */
@@ -0,0 +1,554 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <comp421/filesystem.h>
+#include <comp421/yalnix.h>
+
+
+/**
+ * Host stand-in for the Yalnix kernel calls used by the YFS server, the YFS
+ * library and the test programs, so that they can be built and run as plain
+ * Linux processes.
+ *
+ * The disk is the DISK file made by mkyfs, accessed one sector at a time.
+ * Message passing is carried over a Unix domain socket that the file server
+ * listens on after Register(). A client blocked in Send() services the
+ * CopyFrom/CopyTo requests of the server on the same connection until the
+ * Reply arrives, which gives the server the same view of client memory that
+ * the Yalnix kernel provides.
+ *
+ * Environment variables:
+ *  YFS_HOST_DISK: path of the disk image (default "DISK").
+ *  YFS_HOST_SOCKET: path of the server socket (default "YFS_SOCKET").
+ *  YFS_HOST_TRACE: TracePrintf level, messages above it are dropped (default 0).
+ *  YFS_HOST_STATS: if set, the server prints disk and IPC counters on exit.
+ */
+
+/* Size of every Yalnix message. */
+#define MSGSIZE 32
+
+/* Maximum number of clients connected to the server at once. */
+#define MAX_CLIENTS 64
+
+/* Length of a Delay() clock tick in microseconds. */
+#define TICK_USEC 10000
+
+/* Frame types exchanged between a client and the server. */
+#define FRAME_HELLO     0   // client -> server, len holds the client pid
+#define FRAME_MSG       1   // client -> server, MSGSIZE byte request
+#define FRAME_REPLY     2   // server -> client, MSGSIZE byte reply
+#define FRAME_COPYFROM  3   // server -> client, asks for len bytes at addr
+#define FRAME_COPYDATA  4   // client -> server, len bytes answering COPYFROM
+#define FRAME_COPYTO    5   // server -> client, len bytes to store at addr
+
+/* Header that precedes every frame on a connection. */
+struct frame {
+    int type;
+    int len;
+    void *addr;
+};
+
+/* Struct for a client connected to the server. */
+struct client {
+    int fd;     // connection to the client
+    int pid;    // pid the client reported in its hello frame
+};
+
+// Disk image, opened on first use
+static int diskFd = -1;
+
+// Server side: listening socket and connected clients
+static int listenFd = -1;
+static char listenPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static int listenOwner = 0;
+static struct client clients[MAX_CLIENTS];
+static int numClients = 0;
+static int nextClient = 0;
+
+// Client side: connection to the server and the process that owns it
+static int serverFd = -1;
+static int serverOwner = 0;
+
+// Counters reported on exit when YFS_HOST_STATS is set
+static long sectorReads = 0;
+static long sectorWrites = 0;
+static long messages = 0;
+static long copies = 0;
+static long copyBytes = 0;
+
+
+/* Helper Functions */
+
+
+/**
+ * This function returns the value of the given environment variable, or the
+ * given default if it is not set.
+ */
+static char *
+getSetting(char *name, char *defaultValue)
+{
+    char *value = getenv(name);
+    return (value != NULL) ? value : defaultValue;
+}
+
+/**
+ * This function reads exactly len bytes from fd into buf.
+ *
+ * Outputs:
+ *  Returns 0 on success, or ERROR on end of file or failure.
+ */
+static int
+readFully(int fd, void *buf, int len)
+{
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return ERROR;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * This function writes exactly len bytes from buf to fd.
+ *
+ * Outputs:
+ *  Returns 0 on success, or ERROR on failure.
+ */
+static int
+writeFully(int fd, void *buf, int len)
+{
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return ERROR;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * This function sends a frame header followed by an optional payload.
+ *
+ * Outputs:
+ *  Returns 0 on success, or ERROR on failure.
+ */
+static int
+sendFrame(int fd, int type, void *addr, int len, void *payload)
+{
+    struct frame frame;
+    frame.type = type;
+    frame.len = len;
+    frame.addr = addr;
+    if (writeFully(fd, &frame, sizeof(frame)) == ERROR) {
+        return ERROR;
+    }
+    if (payload != NULL && writeFully(fd, payload, len) == ERROR) {
+        return ERROR;
+    }
+    return 0;
+}
+
+/**
+ * This function opens the disk image if it is not open yet.
+ *
+ * Outputs:
+ *  Returns 0 on success, or ERROR if the image cannot be opened.
+ */
+static int
+openDisk(void)
+{
+    if (diskFd >= 0) {
+        return 0;
+    }
+    char *path = getSetting("YFS_HOST_DISK", "DISK");
+    diskFd = open(path, O_RDWR | O_CLOEXEC);
+    if (diskFd < 0) {
+        fprintf(stderr, "host: cannot open disk %s: %s\n", path, strerror(errno));
+        return ERROR;
+    }
+    return 0;
+}
+
+/**
+ * This function fills in the address of the server socket.
+ */
+static void
+getServerAddress(struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strncpy(addr->sun_path, getSetting("YFS_HOST_SOCKET", "YFS_SOCKET"),
+        sizeof(addr->sun_path) - 1);
+}
+
+/**
+ * This function returns the index of the connected client with the given pid,
+ * or -1 if there is none.
+ */
+static int
+findClient(int pid)
+{
+    int i;
+    for (i = 0; i < numClients; i++) {
+        if (clients[i].pid == pid) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * This function closes the connection to the client at the given index and
+ * removes it from the client table.
+ */
+static void
+dropClient(int index)
+{
+    close(clients[index].fd);
+    clients[index] = clients[--numClients];
+}
+
+/**
+ * This function accepts a new client connection and reads its hello frame.
+ */
+static void
+acceptClient(void)
+{
+    int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct frame hello;
+    if (numClients == MAX_CLIENTS || readFully(fd, &hello, sizeof(hello)) == ERROR
+            || hello.type != FRAME_HELLO) {
+        close(fd);
+        return;
+    }
+    clients[numClients].fd = fd;
+    clients[numClients].pid = hello.len;
+    numClients++;
+}
+
+/**
+ * This function reaps exited children of the server and reports whether any
+ * are still running.
+ */
+static int
+childrenRunning(void)
+{
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        ;
+    return pid == 0;
+}
+
+/**
+ * This function removes the socket of the server when it exits.
+ */
+static void
+removeSocket(void)
+{
+    // A forked child that failed to Exec must not take the socket with it.
+    if (getpid() == listenOwner) {
+        unlink(listenPath);
+    }
+}
+
+/**
+ * This function prints the disk and IPC counters of the server.
+ */
+static void
+printStats(void)
+{
+    fprintf(stderr, "host: %ld sector reads, %ld sector writes, %ld messages, "
+        "%ld copies (%ld bytes)\n", sectorReads, sectorWrites, messages, copies,
+        copyBytes);
+}
+
+
+/* Yalnix Kernel Calls */
+
+
+void
+TracePrintf(int level, char *fmt, ...)
+{
+    static FILE *trace = NULL;
+    static int traceLevel = -1;
+
+    if (traceLevel < 0) {
+        traceLevel = atoi(getSetting("YFS_HOST_TRACE", "0"));
+    }
+    if (level > traceLevel) {
+        return;
+    }
+    if (trace == NULL && (trace = fopen("TRACE", "a")) == NULL) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    fprintf(trace, "[%d] ", (int)getpid());
+    vfprintf(trace, fmt, args);
+    va_end(args);
+    fflush(trace);
+}
+
+int
+Fork(void)
+{
+    // Connections belong to the process that made them.
+    pid_t pid = fork();
+    return (pid < 0) ? ERROR : pid;
+}
+
+int
+Exec(char *filename, char **argvec)
+{
+    execv(filename, argvec);
+    return ERROR;
+}
+
+void
+Exit(int status)
+{
+    exit(status);
+}
+
+int
+GetPid(void)
+{
+    return getpid();
+}
+
+int
+Delay(int clock_ticks)
+{
+    if (clock_ticks < 0) {
+        return ERROR;
+    }
+    usleep(clock_ticks * TICK_USEC);
+    return 0;
+}
+
+int
+ReadSector(int sector, void *buf)
+{
+    if (sector < 0 || sector >= NUMSECTORS || openDisk() == ERROR) {
+        return ERROR;
+    }
+    sectorReads++;
+    if (pread(diskFd, buf, SECTORSIZE, (off_t)sector * SECTORSIZE) != SECTORSIZE) {
+        return ERROR;
+    }
+    return 0;
+}
+
+int
+WriteSector(int sector, void *buf)
+{
+    if (sector < 0 || sector >= NUMSECTORS || openDisk() == ERROR) {
+        return ERROR;
+    }
+    sectorWrites++;
+    if (pwrite(diskFd, buf, SECTORSIZE, (off_t)sector * SECTORSIZE) != SECTORSIZE) {
+        return ERROR;
+    }
+    return 0;
+}
+
+int
+Register(unsigned int service_id)
+{
+    (void) service_id;
+    if (listenFd >= 0) {
+        return ERROR;
+    }
+    struct sockaddr_un addr;
+    getServerAddress(&addr);
+    // Children exec'd by the server find it through the environment.
+    setenv("YFS_HOST_SOCKET", addr.sun_path, 1);
+    unlink(addr.sun_path);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) {
+        return ERROR;
+    }
+    if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+            || listen(listenFd, MAX_CLIENTS) != 0) {
+        close(listenFd);
+        listenFd = -1;
+        return ERROR;
+    }
+    strcpy(listenPath, addr.sun_path);
+    listenOwner = getpid();
+    atexit(removeSocket);
+    if (getenv("YFS_HOST_STATS") != NULL) {
+        atexit(printStats);
+    }
+    return 0;
+}
+
+int
+Send(void *msg, int pid)
+{
+    (void) pid;
+    // Connect on first use, and again in a forked child.
+    if (serverFd < 0 || serverOwner != getpid()) {
+        if (serverFd >= 0) {
+            close(serverFd);
+        }
+        struct sockaddr_un addr;
+        getServerAddress(&addr);
+        serverFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (serverFd < 0) {
+            return ERROR;
+        }
+        serverOwner = getpid();
+        if (connect(serverFd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+                || sendFrame(serverFd, FRAME_HELLO, NULL, serverOwner, NULL) == ERROR) {
+            close(serverFd);
+            serverFd = -1;
+            return ERROR;
+        }
+    }
+
+    if (sendFrame(serverFd, FRAME_MSG, NULL, MSGSIZE, msg) == ERROR) {
+        return ERROR;
+    }
+    // Serve the copy requests of the server until it replies.
+    for (;;) {
+        struct frame frame;
+        if (readFully(serverFd, &frame, sizeof(frame)) == ERROR) {
+            close(serverFd);
+            serverFd = -1;
+            return ERROR;
+        }
+        if (frame.type == FRAME_COPYFROM) {
+            if (sendFrame(serverFd, FRAME_COPYDATA, NULL, frame.len, frame.addr) == ERROR) {
+                return ERROR;
+            }
+        } else if (frame.type == FRAME_COPYTO) {
+            if (readFully(serverFd, frame.addr, frame.len) == ERROR) {
+                return ERROR;
+            }
+        } else if (frame.type == FRAME_REPLY) {
+            return readFully(serverFd, msg, MSGSIZE);
+        } else {
+            return ERROR;
+        }
+    }
+}
+
+int
+Receive(void *msg)
+{
+    struct pollfd fds[MAX_CLIENTS + 1];
+    for (;;) {
+        int i;
+        fds[0].fd = listenFd;
+        fds[0].events = POLLIN;
+        for (i = 0; i < numClients; i++) {
+            fds[i + 1].fd = clients[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+        // With nobody connected, wake up now and then to notice that the
+        // last client has exited.
+        int n = poll(fds, numClients + 1, numClients == 0 ? 50 : -1);
+        if (n < 0 && errno != EINTR) {
+            return ERROR;
+        }
+        if (n > 0) {
+            // Take requests round robin so no client starves the others.
+            int polled = numClients;
+            for (i = 0; i < polled; i++) {
+                int index = (nextClient + i) % polled;
+                if (!(fds[index + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+                    continue;
+                }
+                struct frame frame;
+                if (readFully(clients[index].fd, &frame, sizeof(frame)) == ERROR
+                        || frame.type != FRAME_MSG
+                        || readFully(clients[index].fd, msg, MSGSIZE) == ERROR) {
+                    // Restart the poll since dropping reorders the table.
+                    dropClient(index);
+                    break;
+                }
+                nextClient = index + 1;
+                messages++;
+                return clients[index].pid;
+            }
+            if (fds[0].revents & POLLIN) {
+                acceptClient();
+            }
+        }
+        if (numClients == 0 && !childrenRunning()) {
+            return ERROR;
+        }
+    }
+}
+
+int
+Reply(void *msg, int pid)
+{
+    int index = findClient(pid);
+    if (index < 0 || sendFrame(clients[index].fd, FRAME_REPLY, NULL, MSGSIZE, msg) == ERROR) {
+        return ERROR;
+    }
+    return 0;
+}
+
+int
+CopyFrom(int srcpid, void *dest, void *src, int len)
+{
+    int index = findClient(srcpid);
+    if (index < 0 || len < 0) {
+        return ERROR;
+    }
+    int fd = clients[index].fd;
+    struct frame frame;
+    if (sendFrame(fd, FRAME_COPYFROM, src, len, NULL) == ERROR
+            || readFully(fd, &frame, sizeof(frame)) == ERROR
+            || frame.type != FRAME_COPYDATA || frame.len != len
+            || readFully(fd, dest, len) == ERROR) {
+        return ERROR;
+    }
+    copies++;
+    copyBytes += len;
+    return 0;
+}
+
+int
+CopyTo(int destpid, void *dest, void *src, int len)
+{
+    int index = findClient(destpid);
+    if (index < 0 || len < 0
+            || sendFrame(clients[index].fd, FRAME_COPYTO, dest, len, src) == ERROR) {
+        return ERROR;
+    }
+    copies++;
+    copyBytes += len;
+    return 0;
+}
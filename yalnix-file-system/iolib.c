@@ -6,6 +6,7 @@
 #include <comp421/yalnix.h>
 
 #include "message.h"
+#include "trace.h"
 
 
 /**
@@ -19,11 +20,34 @@
 
 /* Global Variables */
 
+// Number of blocks in the buffer of each open file.
+#define IO_BUFFER_BLOCKS 4
+#define IO_BUFFER_SIZE (IO_BUFFER_BLOCKS * BLOCKSIZE)
+
 // Struct that contains information about an open file, 
 // including its inode number and the current position in the file.
 struct open_file {
     int inodenum;
     int position;
+    // Buffer of the file's data from offset buf_start, allocated on first use. 
+    // It holds buf_len bytes read from the server, or, if dirty is set, written 
+    // by the client and not sent to the server yet.
+    char *buf;
+    int buf_start;
+    int buf_len;
+    int dirty;
+    // Set once the server has accepted a write to the file, after which 
+    // writes are buffered.
+    int writable;
+    // Size of the file as the server last returned it, the generation of the 
+    // file it is of, and the number of uses left on the lease the server 
+    // granted on it, for Seek to use.
+    int size;
+    int generation;
+    int lease;
+    // Reuse count of the inode when the file was opened, which the server checks 
+    // on each request on it, or 0 if not known.
+    int reuse;
 };
 // Struct that is an array of pointers to struct open_file with a maximum 
 // size of MAX_OPEN_FILES, initialized to NULL.
@@ -34,6 +58,31 @@ int files_open = 0;
 // An integer variable stores the inode number of 
 // the root directory in a file system.
 int current_inode = ROOTINODE;
+
+// Number of paths whose attributes are cached, in sets of two picked by a hash 
+// of the path and the directory it is relative to.
+#define ATTR_CACHE_SLOTS 64
+
+// Struct that holds the attributes of the file a path leads to, as the server 
+// last returned them, with the generation they are of and the number of uses 
+// left on the lease the server granted on them.
+struct cached_attributes {
+    int dir;
+    int inum;
+    int type;
+    int size;
+    int nlink;
+    int generation;
+    int lease;
+    int reuse;
+    int last_use;
+    char path[MAXPATHNAMELEN];
+};
+// Array of cached attributes; a slot with an inum of 0 is empty. dir is the 
+// current directory a relative path was looked up from, or 0 for an absolute path, 
+// and last_use orders the uses of the two slots of a set.
+struct cached_attributes attr_cache[ATTR_CACHE_SLOTS];
+int attr_uses = 0;
 /**
  * Takes an integer file descriptor as input and 
  * returns a pointer to the corresponding open_file struct from 
@@ -73,7 +122,7 @@ getLenForPath(char *pathname)
     
     // Check if the length of the pathname is 0 or greater than the maximum pathname length
     if (i == 0 || i == MAXPATHNAMELEN) {
-        TracePrintf(1, "invalid pathname\n");
+        TRACE_IPC(1, "invalid pathname\n");
         return ERROR;
     }
     
@@ -106,7 +155,7 @@ addFile(int inodenum)
 
     // If file table is full, return error
     if (fd == MAX_OPEN_FILES) {
-        TracePrintf(1, "file table full\n");
+        TRACE_IPC(1, "file table full\n");
         return ERROR;
     }
 
@@ -115,13 +164,21 @@ addFile(int inodenum)
 
     // If memory allocation fails, return error
     if (file_table[fd] == NULL) {
-        TracePrintf(1, "error allocating space for open file\n");
+        TRACE_IPC(1, "error allocating space for open file\n");
         return ERROR;
     }
 
     // Initialize the new file with the given inode number and position
     file_table[fd]->inodenum = inodenum;
     file_table[fd]->position = 0;
+    file_table[fd]->buf = NULL;
+    file_table[fd]->buf_len = 0;
+    file_table[fd]->dirty = 0;
+    file_table[fd]->writable = 0;
+    file_table[fd]->size = 0;
+    file_table[fd]->generation = 0;
+    file_table[fd]->reuse = 0;
+    file_table[fd]->lease = 0;
 
     return fd;
 }
@@ -148,7 +205,8 @@ removeFile(int fd)
         return ERROR;
     }
 
-    // Free the memory occupied by the open_file struct.
+    // Free the memory occupied by the open_file struct and its buffer.
+    free(file->buf);
     free(file);
 
     // Set the file_table entry to NULL
@@ -184,12 +242,50 @@ getFile(int fd)
     return file_table[fd];
 }
 
+/**
+ * This function keeps the size, generation and lease of a file that the server returned 
+ * in the reply to a request on it, in every open file of the file. An open file whose 
+ * buffer holds data read at an older generation drops it, since the file has changed 
+ * since, unless the change is the write the reply is for.
+ * 
+ * Inputs:
+ *  file: a pointer to the open file the request was on.
+ *  reply: a pointer to the reply of the server.
+ *  written: nonzero if the request wrote the file.
+ * 
+ * Outputs: None.
+ * 
+ */
+static void
+noteFileReply(struct open_file *file, struct message_reply *reply, int written)
+{
+    // Replies to other requests carry no generation.
+    if (reply->generation == 0) {
+        return;
+    }
+    int fd;
+    for (fd = 0; fd < MAX_OPEN_FILES; fd++) {
+        struct open_file *other = file_table[fd];
+        if (other == NULL || other->inodenum != file->inodenum) {
+            continue;
+        }
+        if (other->generation != reply->generation && !other->dirty && 
+            !(other == file && written)) {
+            other->buf_len = 0;
+        }
+        other->size = reply->size;
+        other->generation = reply->generation;
+        other->lease = reply->lease;
+    }
+}
+
 /**
  * This function sends a message to the file server with the specified operation and pathname.
  * 
  * Inputs:
  *  operation: an integer indicating the operation to be performed.
  *  pathname: a pointer to a string containing the path of the file or directory.
+ *  reply: a pointer to where to copy the reply of the server on success, or NULL.
  * 
  * Outputs:
  *  Upon success, returns an integer indicating the result of the operation. 
@@ -200,7 +296,7 @@ getFile(int fd)
  *  the current inode number of the file system.
  */
 static int
-sendPathMessage(int operation, char *pathname)
+sendPathMessage(int operation, char *pathname, struct message_reply *reply)
 {
 
     // calls the `getLenForPath` function to determine the length of the pathname.
@@ -212,7 +308,7 @@ sendPathMessage(int operation, char *pathname)
     // allocate memory for a `message_path` struct.
     struct message_path * msg = malloc(sizeof(struct message_path));
     if (msg == NULL) {
-        TracePrintf(1, "error allocating space for path message\n");
+        TRACE_IPC(1, "error allocating space for path message\n");
         return ERROR;
     }
 
@@ -225,12 +321,15 @@ sendPathMessage(int operation, char *pathname)
     // sends message to file server. If `Send` returns an error, the function frees 
     // the memory and returns ERROR.
     if (Send(msg, -FILE_SERVER) != 0) {
-        TracePrintf(1, "error sending message to server\n");
+        TRACE_IPC(1, "error sending message to server\n");
         free(msg);
         return ERROR;
     }
     // msg gets overwritten with reply message after return from Send.
     int code = msg->num;
+    if (reply != NULL && code != ERROR) {
+        memcpy(reply, msg, sizeof(struct message_reply));
+    }
     // free memory allocated for msg and return code.
     free(msg);
     return code;
@@ -242,7 +341,7 @@ sendPathMessage(int operation, char *pathname)
  * 
  * Inputs:
  *  operation: an integer indicating the operation to be performed.
- *  inodenum: an integer indicating the inode number.
+ *  file: a pointer to the open file the operation is on.
  *  buf: a pointer to the buffer containing the file contents.
  *  size: an integer indicating the size of the buffer.
  *  offset: an integer indicating the file offset.
@@ -251,9 +350,12 @@ sendPathMessage(int operation, char *pathname)
  *  Upon success, returns an integer indicating the result of the operation. 
  *  Otherwise, returns ERROR.
  * 
+ * Notes:
+ *  - The size of the file returned with the result is kept in the open files of the 
+ *    file by noteFileReply.
  */
 static int
-sendFileMessage(int operation, int inodenum, void *buf, int size, int offset)
+sendFileMessage(int operation, struct open_file *file, void *buf, int size, int offset)
 {
 
     // Check if buffer size is negative or if buffer is NULL.
@@ -263,24 +365,30 @@ sendFileMessage(int operation, int inodenum, void *buf, int size, int offset)
     // Allocate space for file message.
     struct message_file * msg = malloc(sizeof(struct message_file));
     if (msg == NULL) {
-        TracePrintf(1, "error allocating space for file message\n");
+        TRACE_IPC(1, "error allocating space for file message\n");
         return ERROR;
     }
     // Set msg fields.
     msg->num = operation;
-    msg->inodenum = inodenum;
+    msg->inodenum = file->inodenum;
     msg->buf = buf;
     msg->size = size;
     msg->offset = offset;
+    msg->generation = file->generation;
+    msg->reuse = file->reuse;
 
     // Send message to server and check for errors.
     if (Send(msg, -FILE_SERVER) != 0) {
-        TracePrintf(1, "error sending message to server\n");
+        TRACE_IPC(1, "error sending message to server\n");
         free(msg);
         return ERROR;
     }
-    // Store result code and free message. Returns code.
+    // Store result code and the size of the file, and free message. Returns code.
     int code = msg->num;
+    if (code != ERROR) {
+        noteFileReply(file, (struct message_reply *)msg, 
+            operation == YFS_WRITE || operation == YFS_WRITEV);
+    }
     // free memory allocated for msg and return code.
     free(msg);
     return code;
@@ -317,7 +425,7 @@ sendLinkMessage(int operation, char *oldname, char *newname)
     // Allocate space for link message.
     struct message_link * msg = malloc(sizeof(struct message_link));
     if (msg == NULL) {
-        TracePrintf(1, "error allocating space for path message\n");
+        TRACE_IPC(1, "error allocating space for path message\n");
         return ERROR;
     }
 
@@ -331,7 +439,7 @@ sendLinkMessage(int operation, char *oldname, char *newname)
 
     // Send message to server and check for errors.
     if (Send(msg, -FILE_SERVER) != 0) {
-        TracePrintf(1, "error sending message to server\n");
+        TRACE_IPC(1, "error sending message to server\n");
         free(msg);
         return ERROR;
     }
@@ -374,7 +482,7 @@ sendReadLinkMessage(char *pathname, char *buf, int len)
     // Allocate space for the message to be sent to the file server.
     struct message_readlink * msg = malloc(sizeof(struct message_readlink));
     if (msg == NULL) {
-        TracePrintf(1, "error allocating space for read link message\n");
+        TRACE_IPC(1, "error allocating space for read link message\n");
         return ERROR;
     }
 
@@ -388,7 +496,7 @@ sendReadLinkMessage(char *pathname, char *buf, int len)
 
     // Send the message to the file server and handle any errors that may occur.
     if (Send(msg, -FILE_SERVER) != 0) {
-        TracePrintf(1, "error sending message to server\n");
+        TRACE_IPC(1, "error sending message to server\n");
         free(msg);
         return ERROR;
     }
@@ -400,12 +508,11 @@ sendReadLinkMessage(char *pathname, char *buf, int len)
 }
 
 /**
- * This function sends a message to the file server requesting a change in the current file offset for the file 
- * associated with the specified inode number. 
+ * This function sends a message to the file server requesting a change in the current file offset for the 
+ * given open file, when it cannot be worked out from the size of the file the open file holds. 
  * 
  * Inputs:
- *  inodenum: an integer representing the inode number of the file to seek.
- *  current_position: an integer representing the current offset of the file.
+ *  file: a pointer to the open file to seek, at its current offset.
  *  offset: an integer representing the number of bytes to seek forward or backward from the current position.
  *  whence: an integer indicating the reference point used to calculate the new offset. Possible values are:
  *          - SEEK_SET: the new position is offset bytes from the beginning of the file.
@@ -413,100 +520,99 @@ sendReadLinkMessage(char *pathname, char *buf, int len)
  *          - SEEK_END: the new position is offset bytes from the end of the file.
  * 
  * Outputs:
- *  Upon success, returns YFS_SEEK indicating that the operation was successful. Otherwise, returns ERROR 
- *  indicating that an error occurred while sending the message or allocating memory for the message.
+ *  Upon success, returns the new offset, and keeps the size of the file returned with it in the open 
+ *  files of the file. Otherwise, returns ERROR indicating that the offset is out of the file or that an 
+ *  error occurred while sending the message or allocating memory for the message.
  * 
  */ 
 static int
-sendSeekMessage(int inodenum, int current_position, int offset, int whence)
+sendSeekMessage(struct open_file *file, int offset, int whence)
 {
 
     // Check for invalid inputs.
-    if (inodenum <= 0) {
+    if (file->inodenum <= 0) {
         return ERROR;
     }
 
     // Allocate memory for the message.
     struct message_seek * msg = malloc(sizeof(struct message_seek));
     if (msg == NULL) {
-        TracePrintf(1, "error allocating space for seek message\n");
+        TRACE_IPC(1, "error allocating space for seek message\n");
         return ERROR;
     }
 
     // Set msg fields.
     msg->num = YFS_SEEK;
-    msg->inodenum = inodenum;
-    msg->current_position = current_position;
+    msg->inodenum = file->inodenum;
+    msg->current_position = file->position;
     msg->offset = offset;
     msg->whence = whence;
+    msg->generation = file->generation;
+    msg->reuse = file->reuse;
 
     // Send the message to the file server.
     if (Send(msg, -FILE_SERVER) != 0) {
-        TracePrintf(1, "error sending message to server\n");
+        TRACE_IPC(1, "error sending message to server\n");
         free(msg);
         return ERROR;
     }
     // The reply message overwrites the input message, 
     // so we can read it after the Send() call.
     int code = msg->num;
+    if (code != ERROR) {
+        noteFileReply(file, (struct message_reply *)msg, 0);
+    }
     // free memory allocated for msg and return code.
     free(msg);
     return code;
 }
 
 /**
- * This function sends a message to the file server requesting file metadata for the file specified by pathname. 
+ * This function sends a message to the file server to look up a path, getting back the 
+ * attributes of the file it leads to and a lease on them.
  * 
  * Inputs:
- *  pathname: a pointer to a character string that represents the path name of the file to be queried.
- *  statbuf: a pointer to a struct Stat that will be filled with the metadata of the file.
+ *  pathname: a pointer to a character string that represents the path name to look up.
+ *  len: the length of pathname, as returned by getLenForPath.
+ *  generation: the generation of the attributes cached for the path, or 0 if none are.
+ *  reply: set to the reply of the server, holding the attributes, their generation and 
+ *  the lease.
  * 
  * Outputs:
- *  Upon success, returns YFS_STAT indicating that the operation was successful, and the metadata of the file can 
- *  be found in the statbuf parameter. Otherwise, returns ERROR indicating that an error occurred while sending the 
+ *  Upon success, returns the inode number of the file. Otherwise, returns ERROR indicating 
+ *  that the path does not lead to a file or that an error occurred while sending the 
  *  message or allocating memory for the message.
  * 
  */ 
 static int
-sendStatMessage(char *pathname, struct Stat *statbuf)
+sendLookupMessage(char *pathname, int len, int generation, struct message_reply *reply)
 {
 
-    // check if statbuf is null.
-    if (statbuf == NULL) {
-        return ERROR;
-    }
-
-    // get the length of the pathname.
-    int len = getLenForPath(pathname);
-    if (len == ERROR) {
-        return ERROR;
-    }
-
-    // allocate space for the message.
-    struct message_stat * msg = malloc(sizeof(struct message_stat));
+    // allocate space for the message, which the reply overwrites.
+    struct message_lookup * msg = malloc(sizeof(struct message_reply));
     if (msg == NULL) {
-        TracePrintf(1, "error allocating space for path message\n");
+        TRACE_IPC(1, "error allocating space for lookup message\n");
         return ERROR;
     }
 
     // Set msg fields.
-    msg->num = YFS_STAT;
+    msg->num = YFS_LOOKUP;
     msg->current_inode = current_inode;
     msg->pathname = pathname;
     msg->len = len;
-    msg->statbuf = statbuf;
+    msg->generation = generation;
 
     // send the message to the file server.
     if (Send(msg, -FILE_SERVER) != 0) {
-        TracePrintf(1, "error sending message to server\n");
+        TRACE_IPC(1, "error sending message to server\n");
         free(msg);
         return ERROR;
     }
     // msg gets overwritten with reply message after return from Send
-    int code = msg->num;
+    *reply = *(struct message_reply *)msg;
     // free memory allocated for msg and return code.
     free(msg);
-    return code;
+    return reply->num;
 }
 
 /**
@@ -527,7 +633,7 @@ sendGenericMessage(int operation) {
     // Allocate space for the message. 
     struct message_generic * msg = malloc(sizeof(struct message_generic));
     if (msg == NULL) {
-        TracePrintf(1, "error allocating space for path message\n");
+        TRACE_IPC(1, "error allocating space for path message\n");
         return ERROR;
     }
 
@@ -538,7 +644,7 @@ sendGenericMessage(int operation) {
         // If there was an error sending the message, free the memory 
         // allocated for the message and return an error code.
         if (operation != YFS_SHUTDOWN) {
-            TracePrintf(1, "error sending message to server\n");
+            TRACE_IPC(1, "error sending message to server\n");
         }
         // free memory allocated for msg and return ERROR.
         free(msg);
@@ -551,6 +657,225 @@ sendGenericMessage(int operation) {
     return code;
 }
 
+/**
+ * This function returns the attributes of the file a path leads to. It answers from 
+ * the attribute cache while the lease on the cached attributes lasts, and otherwise 
+ * asks the server, which renews the lease if the attributes are still current and 
+ * returns new ones if not.
+ * 
+ * Inputs:
+ *  pathname: a pointer to a string containing the path of the file or directory.
+ *  validate: nonzero to ask the server even while the lease lasts, for a caller that 
+ *  keeps the inode number, which must not be of a file removed since.
+ * 
+ * Outputs:
+ *  Upon success, returns a pointer to the cached attributes of the file. Otherwise, 
+ *  returns NULL if the path does not lead to a file.
+ * 
+ */
+static struct cached_attributes *
+lookupAttributes(char *pathname, int validate)
+{
+    int len = getLenForPath(pathname);
+    if (len == ERROR) {
+        return NULL;
+    }
+
+    // Find the set of the path, and the slot holding it or else the least recently 
+    // used slot of the set.
+    int dir = (pathname[0] == '/') ? 0 : current_inode;
+    unsigned int hash = dir;
+    int i;
+    for (i = 0; pathname[i] != '\0'; i++) {
+        hash = hash * 31 + (unsigned char)pathname[i];
+    }
+    hash ^= hash >> 15;
+    hash *= 0x2c1b3c6d;
+    hash ^= hash >> 12;
+    struct cached_attributes *set = &attr_cache[(hash % (ATTR_CACHE_SLOTS / 2)) * 2];
+    struct cached_attributes *entry = (set[0].last_use <= set[1].last_use) ? &set[0] : &set[1];
+    int cached = 0;
+    for (i = 0; i < 2; i++) {
+        if (set[i].inum != 0 && set[i].dir == dir && strcmp(set[i].path, pathname) == 0) {
+            entry = &set[i];
+            cached = 1;
+        }
+    }
+    entry->last_use = ++attr_uses;
+
+    // Use the cached attributes while their lease lasts.
+    if (cached && entry->lease > 0 && !validate) {
+        entry->lease--;
+        return entry;
+    }
+
+    // Otherwise look the path up on the server, presenting the generation of the 
+    // cached attributes so that it can renew their lease.
+    struct message_reply reply;
+    int inodenum = sendLookupMessage(pathname, len, cached ? entry->generation : 0, &reply);
+    if (inodenum == ERROR) {
+        if (cached) {
+            entry->inum = 0;
+        }
+        return NULL;
+    }
+    entry->dir = dir;
+    entry->inum = inodenum;
+    entry->type = reply.type;
+    entry->size = reply.size;
+    entry->nlink = reply.nlink;
+    entry->generation = reply.generation;
+    entry->lease = reply.lease;
+    entry->reuse = reply.reuse;
+    memcpy(entry->path, pathname, len);
+    return entry;
+}
+
+/**
+ * This function drops cached attributes that a request of this process changes: those 
+ * of one file whose data it writes, or all of them when it adds or removes names.
+ * 
+ * Inputs:
+ *  inodenum: the inode number of the file, or 0 to drop every cached path.
+ * 
+ * Outputs: None.
+ * 
+ */
+static void
+invalidateAttributes(int inodenum)
+{
+    int i;
+    for (i = 0; i < ATTR_CACHE_SLOTS; i++) {
+        if (inodenum == 0 || attr_cache[i].inum == inodenum) {
+            attr_cache[i].inum = 0;
+        }
+    }
+}
+
+
+/**
+ * This function sends the data written to an open file and held in its buffer to 
+ * the file server. The data stays in the buffer afterwards, as data read from the 
+ * file.
+ * 
+ * Inputs:
+ *  file: a pointer to the open file to flush.
+ * 
+ * Outputs:
+ *  Upon success, returns 0. Otherwise, returns ERROR, and the buffered data is dropped.
+ * 
+ */
+static int
+flushFile(struct open_file *file)
+{
+    if (!file->dirty) {
+        return 0;
+    }
+    file->dirty = 0;
+    if (file->buf_len == 0) {
+        return 0;
+    }
+    // Send the buffered data to the server as a single write.
+    invalidateAttributes(file->inodenum);
+    int bytes = sendFileMessage(YFS_WRITE, file, file->buf, file->buf_len, file->buf_start);
+    if (bytes != file->buf_len) {
+        TRACE_IPC(1, "error writing %d buffered bytes of inode %d\n", file->buf_len, file->inodenum);
+        file->buf_len = 0;
+        return ERROR;
+    }
+    return 0;
+}
+
+/**
+ * This function flushes the buffers of the other open files of the same file as the 
+ * given one, so that the server has their writes before it is asked for the file's 
+ * data, and drops what they hold and their lease on its size when the file is about 
+ * to change.
+ * 
+ * Inputs:
+ *  file: a pointer to the open file.
+ *  drop: nonzero to also drop the data held in the buffers.
+ * 
+ * Outputs:
+ *  Upon success, returns 0. Otherwise, returns ERROR.
+ * 
+ */
+static int
+flushOtherFiles(struct open_file *file, int drop)
+{
+    int code = 0;
+    int fd;
+    for (fd = 0; fd < MAX_OPEN_FILES; fd++) {
+        struct open_file *other = file_table[fd];
+        if (other == NULL || other == file || other->inodenum != file->inodenum) {
+            continue;
+        }
+        if (flushFile(other) == ERROR) {
+            code = ERROR;
+        }
+        if (drop) {
+            other->buf_len = 0;
+            other->lease = 0;
+        }
+    }
+    return code;
+}
+
+/**
+ * This function flushes the buffers of every open file.
+ * 
+ * Inputs:
+ *  drop: nonzero to also drop the data held in the buffers and the leases on the 
+ *  sizes of the files.
+ * 
+ * Outputs:
+ *  Upon success, returns 0. Otherwise, returns ERROR.
+ * 
+ */
+static int
+flushAllFiles(int drop)
+{
+    int code = 0;
+    int fd;
+    for (fd = 0; fd < MAX_OPEN_FILES; fd++) {
+        struct open_file *file = file_table[fd];
+        if (file == NULL) {
+            continue;
+        }
+        if (flushFile(file) == ERROR) {
+            code = ERROR;
+        }
+        if (drop) {
+            file->buf_len = 0;
+            file->lease = 0;
+        }
+    }
+    return code;
+}
+
+/**
+ * This function allocates the buffer of an open file if it does not have one yet.
+ * 
+ * Inputs:
+ *  file: a pointer to the open file.
+ * 
+ * Outputs:
+ *  Upon success, returns 0. Otherwise, returns ERROR.
+ * 
+ */
+static int
+getFileBuffer(struct open_file *file)
+{
+    if (file->buf == NULL) {
+        file->buf = malloc(IO_BUFFER_SIZE);
+        if (file->buf == NULL) {
+            TRACE_IPC(1, "error allocating space for file buffer\n");
+            return ERROR;
+        }
+    }
+    return 0;
+}
+
 
 /* Required Procedure Call Requests */
 
@@ -570,15 +895,23 @@ int
 Open(char *pathname)
 {
 
-    // send a message to the server requesting to open the file.
-    int inodenum = sendPathMessage(YFS_OPEN, pathname);
-    if (inodenum == ERROR) {
-        TracePrintf(1, "received error from server\n");
+    // look up the file on the server, which renews the lease on its cached 
+    // attributes, so that the file is not one removed since they were cached.
+    struct cached_attributes *attributes = lookupAttributes(pathname, 1);
+    if (attributes == NULL) {
+        TRACE_IPC(1, "received error from server\n");
         return ERROR;
     }
-    // try to add a file to the array and return fd or ERROR.
-    TracePrintf(2, "inode num %d\n", inodenum);
-    return addFile(inodenum);
+    // try to add a file to the array, starting from the size of the file and 
+    // the reuse count of its inode, and return fd or ERROR. The lease stays with 
+    // the cached attributes, so the file asks for its own on the first Seek.
+    TRACE_IPC(2, "inode num %d\n", attributes->inum);
+    int fd = addFile(attributes->inum);
+    if (fd != ERROR) {
+        file_table[fd]->size = attributes->size;
+        file_table[fd]->reuse = attributes->reuse;
+    }
+    return fd;
 }
 
 /**
@@ -591,14 +924,23 @@ Open(char *pathname)
  * 
  * Outputs:
  *  Upon success, returns 0. Otherwise, returns ERROR if fd is not the 
- *  descriptor number of a file currently open in this process.
+ *  descriptor number of a file currently open in this process, or if the 
+ *  writes buffered for the file could not be sent, in which case it is still closed.
  * 
  */
 int
 Close(int fd)
 {
-    // calls helper function used to remove files, removeFile
-    return removeFile(fd);
+    struct open_file * file = getFile(fd);
+    if (file == NULL) {
+        return ERROR;
+    }
+    // send any buffered writes, then remove the file with removeFile
+    int code = flushFile(file);
+    if (removeFile(fd) == ERROR) {
+        return ERROR;
+    }
+    return code;
 }
 
 /**
@@ -616,15 +958,25 @@ int
 Create(char *pathname)
 {
 
+    // send buffered writes first, since creating an existing file empties it.
+    flushAllFiles(1);
+    invalidateAttributes(0);
     // send a message to the server requesting to open the file..
-    int inodenum = sendPathMessage(YFS_CREATE, pathname);
+    struct message_reply reply;
+    int inodenum = sendPathMessage(YFS_CREATE, pathname, &reply);
     if (inodenum == ERROR) {
-        TracePrintf(1, "received error from server\n");
+        TRACE_IPC(1, "received error from server\n");
         return ERROR;
     }
-    // try to add a file to the array and return fd or error
-    TracePrintf(2, "inode num %d\n", inodenum);
-    return addFile(inodenum);
+    // try to add a file to the array, keeping the reuse count of its inode, and 
+    // return fd or error
+    TRACE_IPC(2, "inode num %d\n", inodenum);
+    int fd = addFile(inodenum);
+    if (fd != ERROR) {
+        file_table[fd]->reuse = reply.reuse;
+        noteFileReply(file_table[fd], &reply, 0);
+    }
+    return fd;
 }
 
 /**
@@ -640,6 +992,14 @@ Create(char *pathname)
  *  Upon success, returns an integer representing the number of bytes read. If reading at the end-of-file, 
  *  returns 0. Otherwise, returns ERROR.
  * 
+ * Notes:
+ *  - Small reads are served from the file's buffer, which is filled IO_BUFFER_BLOCKS blocks at a 
+ *    time from the block holding the position. Reads of a buffer or more go straight to the server.
+ *  - Data buffered by another process is not seen until that process flushes it.
+ *  - Data read into the buffer is dropped on Seek, when a reply from the server shows that the 
+ *    file has changed, and once the lease the server granted on the file runs out, each Read 
+ *    from the buffer using it once. So a Read sees the writes other processes made before the 
+ *    last Seek on fd, but reading on without a Seek it may return data that many reads old.
  */ 
 int
 Read(int fd, void *buf, int size)
@@ -647,18 +1007,68 @@ Read(int fd, void *buf, int size)
 
     // Retrieve the open file corresponding to the given file descriptor.
     struct open_file * file = getFile(fd);
-    if (file == NULL) {
+    if (file == NULL || buf == NULL || size < 0) {
         return ERROR;
     }
-    // Send a message to the file server to read data from the file.
-    int bytes = sendFileMessage(YFS_READ, file->inodenum, buf, size, file->position);
-    if (bytes == ERROR) {
-        TracePrintf(1, "received error from server\n");
+    // Send any buffered writes to the file first.
+    if (flushFile(file) == ERROR) {
         return ERROR;
     }
-    // Update the file position and return the number of bytes read.
-    file->position += bytes;
-    return bytes;
+    // Use the data in the buffer only while the lease on the file lasts.
+    if (file->lease <= 0) {
+        file->buf_len = 0;
+    } else if (file->buf_len > 0) {
+        file->lease--;
+    }
+    int total = 0;
+    while (total < size) {
+        // Copy what the buffer holds from the current position.
+        int bufEnd = file->buf_start + file->buf_len;
+        if (file->buf_len > 0 && file->position >= file->buf_start && file->position < bufEnd) {
+            int bytes = bufEnd - file->position;
+            if (bytes > size - total) {
+                bytes = size - total;
+            }
+            memcpy((char *)buf + total, file->buf + (file->position - file->buf_start), bytes);
+            file->position += bytes;
+            total += bytes;
+            continue;
+        }
+        // The server needs the writes buffered for this file by other open files.
+        if (flushOtherFiles(file, 0) == ERROR) {
+            return ERROR;
+        }
+        // Send a read of at least a buffer's worth straight to the server.
+        if (size - total >= IO_BUFFER_SIZE || getFileBuffer(file) == ERROR) {
+            int bytes = sendFileMessage(YFS_READ, file, (char *)buf + total, size - total, file->position);
+            if (bytes == ERROR) {
+                TRACE_IPC(1, "received error from server\n");
+                return (total > 0) ? total : ERROR;
+            }
+            file->position += bytes;
+            total += bytes;
+            break;
+        }
+        // Otherwise fill the buffer with the blocks from the one holding the position.
+        int start = file->position - file->position % BLOCKSIZE;
+        int bytes = sendFileMessage(YFS_READ, file, file->buf, IO_BUFFER_SIZE, start);
+        if (bytes == ERROR) {
+            TRACE_IPC(1, "received error from server\n");
+            file->buf_len = 0;
+            return (total > 0) ? total : ERROR;
+        }
+        file->buf_start = start;
+        file->buf_len = bytes;
+        // Stop at the end of the file, which it is an error to be past.
+        if (file->position >= start + bytes) {
+            if (file->position > start + bytes && total == 0) {
+                return ERROR;
+            }
+            break;
+        }
+    }
+    // Return the number of bytes read.
+    return total;
 }
 
 /**
@@ -674,6 +1084,10 @@ Read(int fd, void *buf, int size)
  *  Upon success, returns an integer representing the number of bytes written.
  *  Otherwise, returns ERROR.
  * 
+ * Notes:
+ *  - After the first write to a file, small writes are held in the file's buffer and sent to the 
+ *    server when the buffer fills up to a block boundary, on Close, Sync or Shutdown, on a Seek 
+ *    that has to ask the server, or before any request that needs the file's data. An error sending them is returned by that call.
  */ 
 int
 Write(int fd, void *buf, int size)
@@ -681,20 +1095,143 @@ Write(int fd, void *buf, int size)
 
     // get the open file struct associated with the given file descriptor.
     struct open_file * file = getFile(fd);
-    if (file == NULL) {
+    if (file == NULL || buf == NULL || size < 0) {
         // return ERROR if file descriptor is invalid.
         return ERROR;
     }
-    // send a YFS_WRITE message to the server to write data to the file.
-    int bytes = sendFileMessage(YFS_WRITE, file->inodenum, buf, size, file->position);
+    // send the first write to a file straight to the server, so that writing a file 
+    // that cannot be written fails right away, and any write of a buffer or more.
+    if (!file->writable || size >= IO_BUFFER_SIZE || getFileBuffer(file) == ERROR) {
+        if (flushFile(file) == ERROR || flushOtherFiles(file, 1) == ERROR) {
+            return ERROR;
+        }
+        file->buf_len = 0;
+        invalidateAttributes(file->inodenum);
+        int bytes = sendFileMessage(YFS_WRITE, file, buf, size, file->position);
+        if (bytes == ERROR) {
+            // print error message if server returns an error.
+            TRACE_IPC(1, "received error from server\n");
+            return ERROR;
+        }
+        file->writable = 1;
+        // update the position of the file pointer and return the number of bytes written.
+        file->position += bytes;
+        return bytes;
+    }
+    // start buffering writes from the current position unless the buffer already 
+    // holds writes that end there.
+    if (!file->dirty || file->position != file->buf_start + file->buf_len) {
+        if (flushFile(file) == ERROR || flushOtherFiles(file, 1) == ERROR) {
+            return ERROR;
+        }
+        file->buf_start = file->position;
+        file->buf_len = 0;
+        file->dirty = 1;
+    }
+    int total = 0;
+    while (total < size) {
+        // copy as much as fits before the block boundary the buffer ends at.
+        int bufEnd = file->buf_start - file->buf_start % BLOCKSIZE + IO_BUFFER_SIZE;
+        int bytes = bufEnd - file->position;
+        if (bytes > size - total) {
+            bytes = size - total;
+        }
+        memcpy(file->buf + file->buf_len, (char *)buf + total, bytes);
+        file->buf_len += bytes;
+        file->position += bytes;
+        total += bytes;
+        // send a full buffer to the server and carry on buffering after it.
+        if (file->position == bufEnd) {
+            if (flushFile(file) == ERROR) {
+                return ERROR;
+            }
+            file->buf_start = file->position;
+            file->buf_len = 0;
+            file->dirty = 1;
+        }
+    }
+    // return the number of bytes written.
+    return total;
+}
+
+/**
+ * This function reads data from an open file into a list of buffers, filling each 
+ * buffer in turn, beginning at the current position in the file as represented by 
+ * the given file descriptor fd. The whole list takes a single request to the server.
+ * 
+ * Inputs:
+ *  fd: an integer representing the file descriptor number of the file to be read.
+ *  iov: an array of count buffers, each with its address and length.
+ *  count: an integer representing the number of buffers, at most MAX_IOVECS.
+ * 
+ * Outputs:
+ *  Upon success, returns an integer representing the number of bytes read. If reading at the 
+ *  end-of-file, returns 0. Otherwise, returns ERROR.
+ * 
+ */ 
+int
+ReadV(int fd, struct IoVec *iov, int count)
+{
+
+    // Retrieve the open file corresponding to the given file descriptor.
+    struct open_file * file = getFile(fd);
+    if (file == NULL || count > MAX_IOVECS) {
+        return ERROR;
+    }
+    // The server needs any writes buffered for the file first.
+    if (flushFile(file) == ERROR || flushOtherFiles(file, 0) == ERROR) {
+        return ERROR;
+    }
+    // Send a message to the file server to read data from the file into the buffers.
+    int bytes = sendFileMessage(YFS_READV, file, iov, count, file->position);
     if (bytes == ERROR) {
-        // print error message if server returns an error.
-        TracePrintf(1, "received error from server\n");
+        TRACE_IPC(1, "received error from server\n");
         return ERROR;
     }
-    // update the position of the file pointer.
+    // Update the file position and return the number of bytes read.
+    file->position += bytes;
+    return bytes;
+}
+
+/**
+ * This function writes data to an open file from a list of buffers, taking each 
+ * buffer in turn, beginning at the current position in the file as represented by 
+ * the given file descriptor fd. The whole list takes a single request to the server.
+ * 
+ * Inputs:
+ *  fd: an integer representing the file descriptor number of the file to be written.
+ *  iov: an array of count buffers, each with its address and length.
+ *  count: an integer representing the number of buffers, at most MAX_IOVECS.
+ * 
+ * Outputs:
+ *  Upon success, returns an integer representing the number of bytes written.
+ *  Otherwise, returns ERROR.
+ * 
+ */ 
+int
+WriteV(int fd, struct IoVec *iov, int count)
+{
+
+    // Retrieve the open file corresponding to the given file descriptor.
+    struct open_file * file = getFile(fd);
+    if (file == NULL || count > MAX_IOVECS) {
+        return ERROR;
+    }
+    // Send any writes buffered for the file first, and drop the data buffered 
+    // for it, which this write may change.
+    if (flushFile(file) == ERROR || flushOtherFiles(file, 1) == ERROR) {
+        return ERROR;
+    }
+    file->buf_len = 0;
+    invalidateAttributes(file->inodenum);
+    // Send a message to the file server to write data to the file from the buffers.
+    int bytes = sendFileMessage(YFS_WRITEV, file, iov, count, file->position);
+    if (bytes == ERROR) {
+        TRACE_IPC(1, "received error from server\n");
+        return ERROR;
+    }
+    // Update the file position and return the number of bytes written.
     file->position += bytes;
-    // return the number of bytes written.
     return bytes;
 }
 
@@ -719,6 +1256,11 @@ Write(int fd, void *buf, int size)
  *  Upon success, returns an integer representing the new position (offset) in the open file. 
  *  Otherwise, returns ERROR.
  * 
+ * Notes:
+ *  - The new position is worked out from the size of the file returned by the server with the 
+ *    last request on it, including any writes held in the file's buffer. Only a position past 
+ *    that size, which the file may since have grown to, or a SEEK_END once the lease on the 
+ *    size has run out, takes a request to the server.
  */ 
 int
 Seek(int fd, int offset, int whence)
@@ -733,10 +1275,46 @@ Seek(int fd, int offset, int whence)
     if (file == NULL) {
         return ERROR;
     }
-    // Send a message to the server to perform the seek operation.
-    int position = sendSeekMessage(file->inodenum, file->position, offset, whence);
+    // Drop the data read into the buffer, so that reading from the new position 
+    // sees what other processes have written since.
+    if (!file->dirty) {
+        file->buf_len = 0;
+    }
+    // Find the end of the file as far as this process knows, with the writes 
+    // held in its buffer.
+    int size = file->size;
+    if (file->dirty && file->buf_start + file->buf_len > size) {
+        size = file->buf_start + file->buf_len;
+    }
+    // Work out the new position, which must not be before the start of the file 
+    // or, with SEEK_END, after its end.
+    int position;
+    if (whence == SEEK_SET) {
+        position = offset;
+    } else if (whence == SEEK_CUR) {
+        position = file->position + offset;
+    } else {
+        position = size + offset;
+    }
+    if (position < 0 || (whence == SEEK_END && offset > 0)) {
+        return ERROR;
+    }
+    // Move there if it is within the file, as long as the size can still be used 
+    // for a SEEK_END.
+    if (position <= size && (whence != SEEK_END || file->lease > 0)) {
+        if (whence == SEEK_END) {
+            file->lease--;
+        }
+        return (file->position = position);
+    }
+    // Otherwise send any buffered writes to the file, which may also move the end 
+    // of the file, and ask the server.
+    if (flushFile(file) == ERROR || flushOtherFiles(file, 0) == ERROR) {
+        return ERROR;
+    }
+    position = sendSeekMessage(file, offset, whence);
     if (position == ERROR) {
-        TracePrintf(1, "received error from server\n");
+        TRACE_IPC(1, "received error from server\n");
         return ERROR;
     }
     // Update the position in the open file and return the new position.
@@ -761,10 +1339,11 @@ Link(char *oldname, char *newname)
 {
 
     // Call the sendLinkMessage function with the YFS_LINK command and the given old and new names.
+    invalidateAttributes(0);
     int code = sendLinkMessage(YFS_LINK, oldname, newname);
     // If the return code indicates an error, print a message to the console.
     if (code == ERROR) {
-        TracePrintf(1, "received error from server\n");
+        TRACE_IPC(1, "received error from server\n");
     }
     // Return the code (either 0 for success or ERROR for failure).
     return code;
@@ -785,11 +1364,13 @@ Link(char *oldname, char *newname)
 int
 Unlink(char *pathname)
 {
-    // Send an unlink message to the server with the given pathname.
-    int code = sendPathMessage(YFS_UNLINK, pathname);\
+    // Send an unlink message to the server with the given pathname, dropping 
+    // the cached attributes it may change.
+    invalidateAttributes(0);
+    int code = sendPathMessage(YFS_UNLINK, pathname, NULL);
     // If the code is an error, print an error message.
     if (code == ERROR) {
-        TracePrintf(1, "received error from server\n");
+        TRACE_IPC(1, "received error from server\n");
     }
     // Return the code (either 0 for success or ERROR for failure).
     return code;
@@ -815,10 +1396,11 @@ SymLink(char *oldname, char *newname)
 {
 
     // Send a symbolic link message to the server with the given oldname and newname.
+    invalidateAttributes(0);
     int code = sendLinkMessage(YFS_SYMLINK, oldname, newname);
     // If the code is an error, print an error message.
     if (code == ERROR) {
-        TracePrintf(1, "received error from server\n");
+        TRACE_IPC(1, "received error from server\n");
     }
     // Return the code (either 0 for success or ERROR for failure).
     return code;
@@ -844,7 +1426,7 @@ ReadLink(char *pathname, char *buf, int len)
     int code = sendReadLinkMessage(pathname, buf, len);
     // If the code is an error, print an error message.
     if (code == ERROR) {
-        TracePrintf(1, "received error from server\n");
+        TRACE_IPC(1, "received error from server\n");
     }
     // Return the code (either the length of the name or ERROR for failure).
     return code;
@@ -865,10 +1447,11 @@ MkDir(char *pathname)
 {
 
     // Send a make directory message to the server with the given pathname.
-    int code = sendPathMessage(YFS_MKDIR, pathname);
+    invalidateAttributes(0);
+    int code = sendPathMessage(YFS_MKDIR, pathname, NULL);
     // If the code is an error, print an error message.
     if (code == ERROR) {
-        TracePrintf(1, "received error from server\n");
+        TRACE_IPC(1, "received error from server\n");
     }
     // Return the code (either 0 for success or ERROR for failure).
     return code;
@@ -893,10 +1476,11 @@ RmDir(char *pathname)
 {
 
     // Send an fstat message to the server with the given file descriptor.
-    int code = sendPathMessage(YFS_RMDIR, pathname);
+    invalidateAttributes(0);
+    int code = sendPathMessage(YFS_RMDIR, pathname, NULL);
     // If the code is an error, print an error message.
     if (code == ERROR) {
-        TracePrintf(1, "received error from server\n");
+        TRACE_IPC(1, "received error from server\n");
     }
     // Return the code (either 0 for success or ERROR for failure).
     return code;
@@ -919,12 +1503,12 @@ RmDir(char *pathname)
 int
 ChDir(char *pathname)
 {
-    int inodenum = sendPathMessage(YFS_CHDIR, pathname);
-    if (inodenum == ERROR) {
-        TracePrintf(1, "received error from server\n");
+    struct cached_attributes *attributes = lookupAttributes(pathname, 1);
+    if (attributes == NULL) {
+        TRACE_IPC(1, "received error from server\n");
         return ERROR;
     }
-    current_inode = inodenum;
+    current_inode = attributes->inum;
     return 0;
 }
 
@@ -944,13 +1528,171 @@ int
 Stat(char *pathname, struct Stat *statbuf)
 {
 
-    // Send a stat message to the server with the given pathname and statbuf.
-    int code = sendStatMessage(pathname, statbuf);
-    // If the code is an error, print an error message.
+    // Send buffered writes first, so the size of a file being written is current.
+    flushAllFiles(0);
+    if (statbuf == NULL) {
+        return ERROR;
+    }
+    // Look up the file, in the attribute cache if its lease lasts.
+    struct cached_attributes *attributes = lookupAttributes(pathname, 0);
+    if (attributes == NULL) {
+        TRACE_IPC(1, "received error from server\n");
+        return ERROR;
+    }
+    statbuf->inum = attributes->inum;
+    statbuf->type = attributes->type;
+    statbuf->size = attributes->size;
+    statbuf->nlink = attributes->nlink;
+    return 0;
+}
+
+/**
+ * This function lists the open directory specified by the file descriptor fd, filling 
+ * buf with as many struct DirRecord (declared in message.h) as fit, one for each entry 
+ * in use from the current position on. Each record holds the name, inode number, type, 
+ * link count and size of the entry, followed by the target of a symbolic link, so a 
+ * whole buffer of entries takes a single request to the server.
+ * 
+ * Inputs:
+ *  fd: an integer representing the file descriptor number of the directory.
+ *  buf: a pointer to the buffer to fill with records.
+ *  size: an integer representing the size of the buffer in bytes.
+ * 
+ * Outputs:
+ *  Upon success, returns the number of bytes of records in buf, or 0 once the whole 
+ *  directory has been listed. Otherwise, returns ERROR, also when buf is too small 
+ *  for the next record.
+ * 
+ * Notes:
+ *  - The position of the open directory is the cookie listing resumes from, and is 
+ *    moved to the cookie of the last record returned. Seek to the cookie of any 
+ *    record to list again from the entry after it.
+ */
+int
+ReadDir(int fd, void *buf, int size)
+{
+
+    // Retrieve the open file corresponding to the given file descriptor.
+    struct open_file * file = getFile(fd);
+    if (file == NULL) {
+        return ERROR;
+    }
+    // Send a message to the file server to list the directory from the current position.
+    int bytes = sendFileMessage(YFS_READDIR, file, buf, size, file->position);
+    if (bytes == ERROR) {
+        TRACE_IPC(1, "received error from server\n");
+        return ERROR;
+    }
+    // Move the position to the cookie of the last record.
+    int offset = 0;
+    while (offset < bytes) {
+        struct DirRecord *record = (struct DirRecord *)((char *)buf + offset);
+        file->position = record->cookie;
+        offset += record->reclen;
+    }
+    return bytes;
+}
+
+/**
+ * This function submits a batch of operations to the file server in a single request. 
+ * The server runs them in order, skipping any operation linked to one that failed, 
+ * and fills in results with the result of each, as the library call of the same name 
+ * would return it. See struct BatchOp in message.h.
+ * 
+ * Inputs:
+ *  ops: an array of count operations.
+ *  count: an integer representing the number of operations, at most MAX_BATCH_OPS.
+ *  results: an array of count integers set to the result of each operation, ERROR 
+ *  for one that failed or was not run.
+ * 
+ * Outputs:
+ *  Upon success, returns the number of operations that succeeded. Otherwise, returns 
+ *  ERROR if the batch is malformed or could not be submitted, and none of it was run.
+ * 
+ * Notes:
+ *  - Files opened or created by the batch are added to the file table, and their 
+ *    results are file descriptors, as for Open and Create.
+ *  - The batch returns no reuse counts, so the server does not check that the 
+ *    inodes of those files are not freed and reused while they are open.
+ */
+int
+Batch(struct BatchOp *ops, int count, int *results)
+{
+
+    // Check for invalid inputs.
+    if (ops == NULL || results == NULL || count <= 0 || count > MAX_BATCH_OPS) {
+        return ERROR;
+    }
+
+    // Copy the operations, filling in the lengths of their path names and the 
+    // inode numbers of the open files they read or write.
+    struct BatchOp batch[MAX_BATCH_OPS];
+    int i;
+    for (i = 0; i < count; i++) {
+        batch[i] = ops[i];
+        batch[i].inodenum = 0;
+        batch[i].reuse = 0;
+        batch[i].path_len = 0;
+        batch[i].new_len = 0;
+        if (batch[i].pathname != NULL 
+            && (batch[i].path_len = getLenForPath(batch[i].pathname)) == ERROR) {
+            return ERROR;
+        }
+        if (batch[i].newname != NULL 
+            && (batch[i].new_len = getLenForPath(batch[i].newname)) == ERROR) {
+            return ERROR;
+        }
+        if ((batch[i].op == YFS_READ || batch[i].op == YFS_WRITE) && batch[i].fd != -1) {
+            struct open_file * file = getFile(batch[i].fd);
+            if (file == NULL) {
+                return ERROR;
+            }
+            batch[i].inodenum = file->inodenum;
+            batch[i].reuse = file->reuse;
+        }
+    }
+
+    // Send buffered writes first, and drop buffered data and attributes the batch may change.
+    flushAllFiles(1);
+    invalidateAttributes(0);
+
+    // Allocate space for the message.
+    struct message_batch * msg = malloc(sizeof(struct message_batch));
+    if (msg == NULL) {
+        TRACE_IPC(1, "error allocating space for batch message\n");
+        return ERROR;
+    }
+
+    // Set msg fields.
+    msg->num = YFS_BATCH;
+    msg->current_inode = current_inode;
+    msg->ops = batch;
+    msg->results = results;
+    msg->count = count;
+
+    // Send the message to the file server.
+    if (Send(msg, -FILE_SERVER) != 0) {
+        TRACE_IPC(1, "error sending message to server\n");
+        free(msg);
+        return ERROR;
+    }
+    // msg gets overwritten with reply message after return from Send.
+    int code = msg->num;
+    free(msg);
     if (code == ERROR) {
-        TracePrintf(1, "received error from server\n");
+        TRACE_IPC(1, "received error from server\n");
+        return ERROR;
+    }
+
+    // Give each file the batch opened or created a file descriptor.
+    for (i = 0; i < count; i++) {
+        if ((batch[i].op == YFS_OPEN || batch[i].op == YFS_CREATE) && results[i] != ERROR) {
+            results[i] = addFile(results[i]);
+            if (results[i] == ERROR) {
+                code--;
+            }
+        }
     }
-    // Return the code (either 0 for success or ERROR for failure).
     return code;
 }
 
@@ -970,14 +1712,15 @@ int
 Sync()
 {
 
-    // Send a generic message with the YFS_SYNC opcode to the server.
+    // Send buffered writes, then a generic message with the YFS_SYNC opcode to the server.
+    int flushed = flushAllFiles(0);
     int code = sendGenericMessage(YFS_SYNC);
     // Print message if ERROR.
     if (code == ERROR) {
-        TracePrintf(1, "received error from server\n");
+        TRACE_IPC(1, "received error from server\n");
     }
     // Return the code (which should be 0).
-    return code;
+    return (flushed == ERROR) ? ERROR : code;
 }
 
 /**
@@ -996,7 +1739,9 @@ Sync()
 int
 Shutdown()
 {
-    // Send a generic message with the YFS_SHUTDOWN type to initiate the shutdown process.
+    // Send buffered writes, then a generic message with the YFS_SHUTDOWN type to 
+    // initiate the shutdown process.
+    flushAllFiles(0);
     sendGenericMessage(YFS_SHUTDOWN);
     // Return 0 upon success.
     return 0;
@@ -1,8 +1,10 @@
 #include <stdlib.h>
+#include <string.h>
 #include <comp421/filesystem.h>
 #include <comp421/yalnix.h>
 
 #include "message.h"
+#include "trace.h"
 #include "yfs.h"
 
 
@@ -13,6 +15,10 @@
 /* Function to get a path from a process. */
 static char * getPathFromProcess(int pid, char *pathname, int len);
 
+/* Functions to run the operations of a batch. */
+static int processBatch(int pid, struct message_batch *msg);
+static int processBatchOp(int pid, struct BatchOp *op, int currentInode, int linkedResult);
+
 /**
  * This function processes a request received from a user-space process.
  * It determines the message type based on the requested operation, extracts the
@@ -29,6 +35,16 @@ void processRequest(void)
     // A variable to hold the return value of the YFS function that will handle the request.
     int return_value;
 
+    // The reply, which some requests return more than a single integer in.
+    struct message_reply msg_rply;
+    memset(&msg_rply, 0, sizeof(msg_rply));
+
+    // The file a request on a file is on, the generation of it the client 
+    // presented, and its generation when the request arrived, for the reply.
+    int fileInode = 0;
+    int fileGeneration = 0;
+    int currentGeneration = 0;
+
     // A struct to hold the message received from the user-space process.
     struct message_generic msg_rcv;
     
@@ -39,7 +55,7 @@ void processRequest(void)
     if (pid == ERROR) {
         // If the message could not be received, print an error message and
         // shut down the system.
-        TracePrintf(1, "unable to receive message, shutting down\n");
+        TRACE_IPC(1, "unable to receive message, shutting down\n");
         yfsShutdown();
     }
 
@@ -51,6 +67,7 @@ void processRequest(void)
         struct message_path * msg = (struct message_path *) &msg_rcv;
         char *pathname = getPathFromProcess(pid, msg->pathname, msg->len);
         return_value = yfsOpen(pathname, msg->current_inode);
+        fileInode = return_value;
         free(pathname);
     } else if (msg_rcv.num == YFS_CREATE) {
         // If the operation is YFS_CREATE, extract the necessary information
@@ -59,25 +76,57 @@ void processRequest(void)
         struct message_path * msg = (struct message_path *) &msg_rcv;
         char *pathname = getPathFromProcess(pid, msg->pathname, msg->len);
         return_value = yfsCreate(pathname, msg->current_inode, CREATE_NEW);
+        fileInode = return_value;
         free(pathname);
     } else if (msg_rcv.num == YFS_READ) {
         // If the operation is YFS_READ, extract the necessary information
         // from the message and call the YFS function yfsRead() to handle
         // the operation.
         struct message_file * msg = (struct message_file *) &msg_rcv;
-        return_value = yfsRead(msg->inodenum, msg->buf, msg->size, msg->offset, pid);
+        fileInode = msg->inodenum;
+        fileGeneration = msg->generation;
+        currentGeneration = getGeneration(fileInode);
+        return_value = !isOpenInode(msg->inodenum, msg->reuse) ? ERROR : 
+            yfsRead(msg->inodenum, msg->buf, msg->size, msg->offset, pid);
     } else if (msg_rcv.num == YFS_WRITE) {
         // If the operation is YFS_WRITE, extract the necessary information
         // from the message and call the YFS function yfsWrite() to handle
         // the operation.
         struct message_file * msg = (struct message_file *) &msg_rcv;
-        return_value = yfsWrite(msg->inodenum, msg->buf, msg->size, msg->offset, pid);
+        fileInode = msg->inodenum;
+        fileGeneration = msg->generation;
+        currentGeneration = getGeneration(fileInode);
+        return_value = !isOpenInode(msg->inodenum, msg->reuse) ? ERROR : 
+            yfsWrite(msg->inodenum, msg->buf, msg->size, msg->offset, pid);
+    } else if (msg_rcv.num == YFS_READV) {
+        // If the operation is YFS_READV, the message_file holds the address
+        // of the client's array of buffers and their count instead of one
+        // buffer and its size; call yfsReadV() to fill them.
+        struct message_file * msg = (struct message_file *) &msg_rcv;
+        fileInode = msg->inodenum;
+        fileGeneration = msg->generation;
+        currentGeneration = getGeneration(fileInode);
+        return_value = !isOpenInode(msg->inodenum, msg->reuse) ? ERROR : 
+            yfsReadV(msg->inodenum, msg->buf, msg->size, msg->offset, pid);
+    } else if (msg_rcv.num == YFS_WRITEV) {
+        // If the operation is YFS_WRITEV, call yfsWriteV() in the same way
+        // to write the file from the client's array of buffers.
+        struct message_file * msg = (struct message_file *) &msg_rcv;
+        fileInode = msg->inodenum;
+        fileGeneration = msg->generation;
+        currentGeneration = getGeneration(fileInode);
+        return_value = !isOpenInode(msg->inodenum, msg->reuse) ? ERROR : 
+            yfsWriteV(msg->inodenum, msg->buf, msg->size, msg->offset, pid);
     } else if (msg_rcv.num == YFS_SEEK) {
         // If the operation is YFS_SEEK, extract the necessary information
         // from the message and call the YFS function yfsSeek() to handle
         // the operation.
         struct message_seek * msg = (struct message_seek *) &msg_rcv;
-        return_value = yfsSeek(msg->inodenum, msg->offset, msg->whence, msg->current_position);
+        fileInode = msg->inodenum;
+        fileGeneration = msg->generation;
+        currentGeneration = getGeneration(fileInode);
+        return_value = !isOpenInode(msg->inodenum, msg->reuse) ? ERROR : 
+            yfsSeek(msg->inodenum, msg->offset, msg->whence, msg->current_position);
     } else if (msg_rcv.num == YFS_LINK) {
         // If the message type is YFS_LINK, cast the received message to a 
         // message_link struct, get the old and new path names for the link, and
@@ -146,6 +195,27 @@ void processRequest(void)
         char *pathname = getPathFromProcess(pid, msg->pathname, msg->len);
         return_value = yfsStat(pathname, msg->current_inode, msg->statbuf, pid);
         free(pathname);
+    } else if (msg_rcv.num == YFS_READDIR) {
+        // If the message type is YFS_READDIR, cast the received message to a
+        // message_file struct, whose offset holds the cookie to list from, and
+        // call yfsReadDir function to fill the buffer with directory records.
+        struct message_file *msg = (struct message_file *) &msg_rcv;
+        return_value = !isOpenInode(msg->inodenum, msg->reuse) ? ERROR : 
+            yfsReadDir(msg->inodenum, msg->buf, msg->size, msg->offset, pid);
+    } else if (msg_rcv.num == YFS_BATCH) {
+        // If the message type is YFS_BATCH, cast the received message to a
+        // message_batch struct and run each operation of the batch with
+        // processBatch(), which replies with the number that succeeded.
+        struct message_batch *msg = (struct message_batch *) &msg_rcv;
+        return_value = processBatch(pid, msg);
+    } else if (msg_rcv.num == YFS_LOOKUP) {
+        // If the message type is YFS_LOOKUP, cast the received message to a
+        // message_lookup struct, extract the path name, and call yfsLookup
+        // function to fill in the reply with the attributes and lease of the file.
+        struct message_lookup *msg = (struct message_lookup *) &msg_rcv;
+        char *pathname = getPathFromProcess(pid, msg->pathname, msg->len);
+        return_value = yfsLookup(pathname, msg->current_inode, msg->generation, &msg_rply);
+        free(pathname);
     } else if (msg_rcv.num == YFS_SYNC) {
         // If the message type is YFS_SYNC, call yfsSync function to flush
         // all modified data blocks and inodes to disk.
@@ -157,15 +227,20 @@ void processRequest(void)
     } else {
         // If the message type is unknown, print a message to the console and
         // return an error value.
-        TracePrintf(1, "unknown operation %d\n", msg_rcv.num);
+        TRACE_IPC(1, "unknown operation %d\n", msg_rcv.num);
         return_value = ERROR;
     }
 
+    // Return the size of the file a request on a file succeeded on, so that the 
+    // client can seek in it on its own.
+    if (fileInode > 0 && return_value != ERROR) {
+        fillFileReply(fileInode, fileGeneration, currentGeneration, &msg_rply);
+    }
+
     // Send reply.
-    struct message_generic msg_rply;
     msg_rply.num = return_value;
     if (Reply(&msg_rply, pid) != 0) {
-        TracePrintf(1, "error sending reply to pid %d\n", pid);
+        TRACE_IPC(1, "error sending reply to pid %d\n", pid);
     }
 }
 
@@ -180,33 +255,202 @@ void processRequest(void)
  * 
  * Outputs:
  *  Upon success, returns a pointer to the newly allocated buffer containing the 
- *  retrieved pathname. Otherwise, returns NULL if memory allocation fails or if 
- *  the copy operation fails.
+ *  retrieved pathname. Otherwise, returns NULL if the length is not between 1 and 
+ *  MAXPATHNAMELEN, if memory allocation fails or if the copy operation fails.
  * 
  * Notes:
  *  - The caller is responsible for freeing the memory allocated by this function.
  *  - This function uses the CopyFrom system call to copy data from the target process.
  *  - If the buffer provided by the caller is not large enough to hold the entire pathname, 
  *    the copy operation will fail.
+ *  - The last byte copied is replaced with a '\0', so the pathname is always terminated 
+ *    whatever the process sent.
  * 
  */
 static char *
 getPathFromProcess(int pid, char *pathname, int len)
 {
+    // Check the length the process gave, which counts the terminating '\0'.
+    if (pathname == NULL || len <= 0 || len > MAXPATHNAMELEN) {
+        TRACE_IPC(1, "invalid pathname of length %d from pid %d\n", len, pid);
+        return NULL;
+    }
     // Allocate a new buffer to store the retrieved pathname.
     char *local_pathname = malloc(len * sizeof (char));
     if (local_pathname == NULL) {
         // If the allocation fails, print an error message and return NULL.
-        TracePrintf(1, "error allocating memory for pathname\n");
+        TRACE_IPC(1, "error allocating memory for pathname\n");
         return NULL;
     }
     // Copy the contents of the pathname buffer from the target process to the newly allocated buffer.
     if (CopyFrom(pid, local_pathname, pathname, len) != 0) {
         // If the copy operation fails, print an error message and return NULL.
-        TracePrintf(1, "error copying %d bytes from %p in pid %d to %p locally\n", 
+        TRACE_IPC(1, "error copying %d bytes from %p in pid %d to %p locally\n", 
                 len, pathname, pid, local_pathname);
+        free(local_pathname);
         return NULL;
     }
+    local_pathname[len - 1] = '\0';
     // If the operation is successful, return a pointer to the new buffer.
     return local_pathname;
-}
\ No newline at end of file
+}
+/**
+ * This function runs a batch of operations submitted by a process in one request. 
+ * It copies the operations in with a single CopyFrom, runs them in order, and copies 
+ * the result of each back with a single CopyTo.
+ * 
+ * Inputs:
+ *  pid: an integer representing the process ID of the submitting process.
+ *  msg: a pointer to the batch message, with the address and count of the 
+ *  operations and the address of the array for their results.
+ * 
+ * Outputs:
+ *  Upon success, returns the number of operations that succeeded. Otherwise, returns 
+ *  ERROR if the batch could not be copied in or its results could not be copied back.
+ * 
+ * Notes:
+ *  - An operation linked to one that failed is not run, and its result is ERROR.
+ *  - The blocks pinned by each operation are released before the next one runs, 
+ *    as they would be between separate requests.
+ * 
+ */
+static int
+processBatch(int pid, struct message_batch *msg)
+{
+    // Check the number of operations.
+    if (msg->count <= 0 || msg->count > MAX_BATCH_OPS || msg->ops == NULL || msg->results == NULL) {
+        return ERROR;
+    }
+
+    // Copy the operations of the batch from the process.
+    struct BatchOp ops[MAX_BATCH_OPS];
+    int results[MAX_BATCH_OPS];
+    if (CopyFrom(pid, ops, msg->ops, msg->count * sizeof(struct BatchOp)) != 0) {
+        TRACE_IPC(1, "error copying %d batch operations from pid %d\n", msg->count, pid);
+        return ERROR;
+    }
+
+    // Run each operation in order, unless the one it is linked to failed.
+    int succeeded = 0;
+    int i;
+    for (i = 0; i < msg->count; i++) {
+        int link = ops[i].link;
+        if (link < 0 || link > i || (link > 0 && results[link - 1] == ERROR)) {
+            results[i] = ERROR;
+            continue;
+        }
+        int linkedResult = (link > 0) ? results[link - 1] : 0;
+        results[i] = processBatchOp(pid, &ops[i], msg->current_inode, linkedResult);
+        releaseRequestPins();
+        if (results[i] != ERROR) {
+            succeeded++;
+        }
+    }
+    TRACE_IPC(2, "ran batch of %d operations from pid %d, %d succeeded\n", msg->count, pid, succeeded);
+
+    // Copy the results back to the process.
+    if (CopyTo(pid, msg->results, results, msg->count * sizeof(int)) != 0) {
+        TRACE_IPC(1, "error copying %d batch results to pid %d\n", msg->count, pid);
+        return ERROR;
+    }
+    return succeeded;
+}
+
+/**
+ * This function runs one operation of a batch by calling the YFS function that 
+ * handles the request of the same type.
+ * 
+ * Inputs:
+ *  pid: an integer representing the process ID of the submitting process.
+ *  op: a pointer to the operation, already copied from the process.
+ *  currentInode: an integer representing the inode number of the current 
+ *  directory of the process.
+ *  linkedResult: the result of the operation this one is linked to, the inode 
+ *  number of the file to read or write when op has none of its own.
+ * 
+ * Outputs:
+ *  The result of the operation, or ERROR.
+ * 
+ */
+static int
+processBatchOp(int pid, struct BatchOp *op, int currentInode, int linkedResult)
+{
+    // Refuse an operation without the path names its type needs.
+    bool needsPath = (op->op == YFS_OPEN || op->op == YFS_CREATE || op->op == YFS_LINK || 
+        op->op == YFS_UNLINK || op->op == YFS_SYMLINK || op->op == YFS_READLINK || 
+        op->op == YFS_MKDIR || op->op == YFS_RMDIR || op->op == YFS_STAT);
+    bool needsNewName = (op->op == YFS_LINK || op->op == YFS_SYMLINK);
+    if ((needsPath && op->pathname == NULL) || (needsNewName && op->newname == NULL)) {
+        TRACE_IPC(1, "batched operation %d from pid %d has no path name\n", op->op, pid);
+        return ERROR;
+    }
+
+    // Copy the path names of the operation from the process.
+    char *pathname = NULL;
+    char *newname = NULL;
+    if (op->pathname != NULL) {
+        pathname = getPathFromProcess(pid, op->pathname, op->path_len);
+        if (pathname == NULL) {
+            return ERROR;
+        }
+    }
+    if (op->newname != NULL) {
+        newname = getPathFromProcess(pid, op->newname, op->new_len);
+        if (newname == NULL) {
+            free(pathname);
+            return ERROR;
+        }
+    }
+
+    // A read or write of no open file uses the file of the operation it is linked to. 
+    // Either way the inode must still be the file the process opened.
+    int inodenum = op->inodenum;
+    int reuse = op->reuse;
+    if (inodenum == 0 && op->link > 0) {
+        inodenum = linkedResult;
+        reuse = 0;
+    }
+    bool isFileOp = (op->op == YFS_READ || op->op == YFS_WRITE);
+    if (isFileOp && (!isOpenInode(inodenum, reuse) || op->buf == NULL || 
+        op->size < 0 || op->offset < 0)) {
+        TRACE_IPC(1, "batched operation %d from pid %d is not on an open file\n", op->op, pid);
+        free(pathname);
+        free(newname);
+        return ERROR;
+    }
+
+    int return_value;
+    if (op->op == YFS_OPEN) {
+        return_value = yfsOpen(pathname, currentInode);
+    } else if (op->op == YFS_CREATE) {
+        return_value = yfsCreate(pathname, currentInode, CREATE_NEW);
+    } else if (op->op == YFS_READ) {
+        return_value = yfsRead(inodenum, op->buf, op->size, op->offset, pid);
+    } else if (op->op == YFS_WRITE) {
+        return_value = yfsWrite(inodenum, op->buf, op->size, op->offset, pid);
+    } else if (op->op == YFS_LINK) {
+        return_value = yfsLink(pathname, newname, currentInode);
+    } else if (op->op == YFS_UNLINK) {
+        return_value = yfsUnlink(pathname, currentInode);
+    } else if (op->op == YFS_SYMLINK) {
+        return_value = yfsSymLink(pathname, newname, currentInode);
+    } else if (op->op == YFS_READLINK) {
+        return_value = yfsReadLink(pathname, op->buf, op->size, currentInode, pid);
+    } else if (op->op == YFS_MKDIR) {
+        return_value = yfsMkDir(pathname, currentInode);
+    } else if (op->op == YFS_RMDIR) {
+        return_value = yfsRmDir(pathname, currentInode);
+    } else if (op->op == YFS_STAT) {
+        return_value = yfsStat(pathname, currentInode, op->buf, pid);
+    } else if (op->op == YFS_SYNC) {
+        return_value = yfsSync();
+    } else {
+        // Other requests, such as Seek, ChDir and Shutdown, cannot be batched.
+        TRACE_IPC(1, "operation %d cannot be batched\n", op->op);
+        return_value = ERROR;
+    }
+
+    free(pathname);
+    free(newname);
+    return return_value;
+}
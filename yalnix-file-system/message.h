@@ -1,4 +1,5 @@
 #include <comp421/iolib.h>
+#include <comp421/filesystem.h>
 
 
 /* message types and IPC API */
@@ -17,6 +18,17 @@
 #define YFS_STAT        12
 #define YFS_SYNC        13
 #define YFS_SHUTDOWN    14
+#define YFS_READDIR     15
+#define YFS_READV       16
+#define YFS_WRITEV      17
+#define YFS_BATCH       18
+#define YFS_LOOKUP      19
+
+/* Most buffers a single ReadV or WriteV can name. */
+#define MAX_IOVECS      64
+
+/* Most operations a single Batch can submit. */
+#define MAX_BATCH_OPS   32
 
 /*
  * Structure for a generic message that can only hold only
@@ -39,14 +51,20 @@ struct message_path {
     char padding[12];
 };
 
-/* Structure for messages useful for requesting file access. */
+/* 
+ * Structure for messages useful for requesting file access. generation is the 
+ * generation of the file the client knows the size of, whose lease it wants 
+ * renewed, or 0. reuse is the reuse count of the inode when the client opened 
+ * it, so that a file freed or reused since is refused, or 0 if not known.
+ */
 struct message_file {
     int num;
     int inodenum;
     void *buf;
     int size;
     int offset;
-    char padding[8];
+    int generation;
+    int reuse;
 };
 
 /* Structure for a Link operation message. */
@@ -76,7 +94,9 @@ struct message_seek {
     int current_position;
     int offset;
     int whence;
-    char padding[12];
+    int generation;
+    int reuse;
+    char padding[4];
 };
 
 /* Structure for a Stat operation message. */
@@ -88,5 +108,104 @@ struct message_stat {
     struct Stat *statbuf;
 };
 
+/*
+ * Structure for an entry of a directory as returned by ReadDir. Records are 
+ * packed one after another in the caller's buffer, reclen bytes apart, and the 
+ * target of a symbolic link follows its record as a '\0' terminated string of 
+ * linklen characters. Listing resumes from the cookie of the last record read.
+ */
+struct DirRecord {
+    int reclen;
+    int cookie;
+    int inum;
+    int type;
+    int nlink;
+    int size;
+    int linklen;
+    char name[DIRNAMELEN + 1];
+};
+
+/* 
+ * Structure for one of the buffers of a ReadV or WriteV, of len bytes at base.
+ */
+struct IoVec {
+    void *base;
+    int len;
+};
+
+/*
+ * Structure for one operation submitted by Batch. op is YFS_OPEN, YFS_CREATE, 
+ * YFS_READ, YFS_WRITE, YFS_LINK, YFS_UNLINK, YFS_SYMLINK, YFS_READLINK, YFS_MKDIR, 
+ * YFS_RMDIR, YFS_STAT or YFS_SYNC, and takes its arguments as the library call of 
+ * the same name does: pathname (the old name of a link), newname, buf and size. 
+ * A read or write is of size bytes at offset of the open file fd, leaving the 
+ * position of fd alone.
+ * 
+ * link is 0, or 1 plus the index of an earlier operation that must succeed for 
+ * this one to run. A read or write with an fd of -1 uses the file opened or 
+ * created by the operation it is linked to.
+ * 
+ * The last four fields are filled in by Batch: the inode number of fd and the 
+ * reuse count it was opened with, and the lengths of the path names.
+ */
+struct BatchOp {
+    int op;
+    int link;
+    int fd;
+    int offset;
+    char *pathname;
+    char *newname;
+    void *buf;
+    int size;
+    int inodenum;
+    int reuse;
+    int path_len;
+    int new_len;
+};
+
+/* Library calls in addition to those of <comp421/iolib.h>. */
+extern int ReadDir(int, void *, int);
+extern int ReadV(int, struct IoVec *, int);
+extern int WriteV(int, struct IoVec *, int);
+extern int Batch(struct BatchOp *, int, int *);
+
+/* Structure for a Lookup operation message. */
+struct message_lookup {
+    int num;
+    int current_inode;
+    char *pathname;
+    int len;
+    int generation;
+    char padding[8];
+};
+
+/*
+ * Structure for the reply to a request. num is the result of the request, and 
+ * a Lookup also returns the attributes of the file, the generation they are 
+ * of, and the lease the client holds on them, in uses, and the reuse count of 
+ * the inode. Open, Create, Read, Write, ReadV, WriteV and Seek return those 
+ * of the file they are on.
+ */
+struct message_reply {
+    int num;
+    int generation;
+    int type;
+    int size;
+    int nlink;
+    int lease;
+    int reuse;
+    char padding[4];
+};
+
+/* Structure for a Batch operation message. */
+struct message_batch {
+    int num;
+    int current_inode;
+    struct BatchOp *ops;
+    int *results;
+    int count;
+    char padding[4];
+};
+
 /* Function to process message requests. */
 void processRequest(void);
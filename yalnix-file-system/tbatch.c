@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <comp421/yalnix.h>
+#include <comp421/iolib.h>
+
+#include "message.h"
+
+/*
+ *  Submits batches in which an operation fails: the operations linked to
+ *  it must not run, while the ones that are not linked to it still do.
+ */
+
+int
+main()
+{
+	struct BatchOp ops[4];
+	int results[4];
+	char buf[8];
+	int status;
+	int i;
+
+	/* Create /x and write to it, then open a missing file and read it. */
+	memset(ops, 0, sizeof(ops));
+	ops[0].op = YFS_CREATE;
+	ops[0].pathname = "/x";
+	ops[1].op = YFS_WRITE;
+	ops[1].link = 1;
+	ops[1].fd = -1;
+	ops[1].buf = "hello";
+	ops[1].size = 5;
+	ops[2].op = YFS_OPEN;
+	ops[2].pathname = "/missing";
+	ops[3].op = YFS_READ;
+	ops[3].link = 3;
+	ops[3].fd = -1;
+	ops[3].buf = buf;
+	ops[3].size = sizeof(buf);
+	status = Batch(ops, 4, results);
+	printf("Batch status %d:", status);
+	for (i = 0; i < 4; i++)
+		printf(" %d", results[i]);
+	printf("\n");
+
+	/* MkDir fails on an existing name, so the Create inside it is skipped. */
+	memset(ops, 0, sizeof(ops));
+	ops[0].op = YFS_MKDIR;
+	ops[0].pathname = "/x";
+	ops[1].op = YFS_CREATE;
+	ops[1].link = 1;
+	ops[1].pathname = "/x/y";
+	ops[2].op = YFS_MKDIR;
+	ops[2].pathname = "/d";
+	status = Batch(ops, 3, results);
+	printf("Batch status %d:", status);
+	for (i = 0; i < 3; i++)
+		printf(" %d", results[i]);
+	printf("\n");
+
+	/* An operation that needs a path name and has none is refused. */
+	memset(ops, 0, sizeof(ops));
+	ops[0].op = YFS_UNLINK;
+	status = Batch(ops, 1, results);
+	printf("Batch status %d: %d\n", status, results[0]);
+
+	Shutdown();
+	return 0;
+}
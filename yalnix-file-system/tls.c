@@ -5,8 +5,11 @@
 #include <comp421/iolib.h>
 #include <comp421/filesystem.h>
 
+#include "message.h"
+
 /*
- *  Works like "ls".
+ *  Works like "ls", listing a buffer of entries with their attributes
+ *  and link targets per ReadDir call.
  *
  *  Uncomment #define below to test symbolic links too.
  */
@@ -18,13 +21,10 @@ main(int argc, char **argv)
 {
     int fd;
     int nch;
-    struct dir_entry entry;
+    int off;
+    static char records[16384];
+    struct DirRecord *rec;
     char *name;
-    struct Stat sb;
-    char buffer[DIRNAMELEN+1];
-#ifdef  TEST_SYMLINKS
-    char link[MAXPATHNAMELEN+1];
-#endif
     char typechar;
 
     name = (argc > 1) ? argv[1] : ".";
@@ -42,52 +42,33 @@ main(int argc, char **argv)
     }
 
     while (1) {
-	nch = Read(fd, (char *)&entry, sizeof(entry));
+	nch = ReadDir(fd, records, sizeof(records));
 	if (nch == 0)
 	    break;
 	else if (nch < 0) {
 	    fprintf(stderr, "ERROR Reading from directory\n");
 	    Shutdown();
 	    Exit(1);
-	} else if (nch != sizeof(entry)) {
-	    fprintf(stderr, "Read wrong byte count %d\n", nch);
-	    Shutdown();
-	    Exit(1);
-	}
-	if (entry.inum == 0) continue;
-	bcopy(entry.name, buffer, DIRNAMELEN);
-	buffer[DIRNAMELEN] = '\0';
-	/* was LinkStat, when supporting symlinks ??? */
-	if (Stat(buffer, &sb) == ERROR) {
-	    fprintf(stderr, "Can't LinkStat %s\n", buffer);
-	    Shutdown();
-	    Exit(1);
 	}
-	switch (sb.type) {
-	    case INODE_REGULAR:	typechar = ' '; break;
-	    case INODE_DIRECTORY:	typechar = 'd'; break;
+	for (off = 0; off < nch; off += rec->reclen) {
+	    rec = (struct DirRecord *)(records + off);
+	    switch (rec->type) {
+		case INODE_REGULAR:	typechar = ' '; break;
+		case INODE_DIRECTORY:	typechar = 'd'; break;
 #ifdef	TEST_SYMLINKS
-	    case INODE_SYMLINK:	typechar = 's'; break;
+		case INODE_SYMLINK:	typechar = 's'; break;
 #endif
-	    default:		typechar = '?'; break;
-	}
-	printf("%4d %c %3d %5d %s",
-	    entry.inum, typechar, sb.nlink, sb.size, buffer);
-#ifdef	TEST_SYMLINKS
-	if (sb.type == INODE_SYMLINK) {
-	    nch = ReadLink(buffer, link, sizeof(link));
-	    if (nch == ERROR) {
-		fprintf(stderr, "Can't ReadLink %s\n",
-		    buffer);
-		Shutdown();
-		Exit(1);
+		default:		typechar = '?'; break;
 	    }
-	    link[nch] = '\0';
-	    printf(" -> %s\n", link);
-	}
-	else
+	    printf("%4d %c %3d %5d %s",
+		rec->inum, typechar, rec->nlink, rec->size, rec->name);
+#ifdef	TEST_SYMLINKS
+	    if (rec->type == INODE_SYMLINK)
+		printf(" -> %s\n", (char *)(rec + 1));
+	    else
 #endif
-	    printf("\n");
+		printf("\n");
+	}
     }
 
     Shutdown();
@@ -0,0 +1,49 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <comp421/yalnix.h>
+
+/*
+ * Compile-time trace levels for each part of the file system: the block cache,
+ * block and inode allocation, directories and path lookup, and the messages
+ * between the library and the server. A trace whose level is above the level of
+ * its part is compiled out, format string and arguments included, so the hot
+ * paths pay nothing for it. Level 0 is for the counters printed at shutdown,
+ * level 1 for errors and events that happen once, and levels 2 and 3 for
+ * tracing individual requests and loop iterations.
+ *
+ * A level can be raised on its own with, e.g., -DTRACE_LEVEL_DIR=3, and building
+ * with -DYFS_TRACE_ALL ("make host-trace") keeps every trace, which TracePrintf
+ * then filters at run time as usual.
+ */
+#ifdef YFS_TRACE_ALL
+#define TRACE_LEVEL_CACHE 9
+#define TRACE_LEVEL_ALLOC 9
+#define TRACE_LEVEL_DIR 9
+#define TRACE_LEVEL_IPC 9
+#endif
+
+#ifndef TRACE_LEVEL_CACHE
+#define TRACE_LEVEL_CACHE 1
+#endif
+#ifndef TRACE_LEVEL_ALLOC
+#define TRACE_LEVEL_ALLOC 1
+#endif
+#ifndef TRACE_LEVEL_DIR
+#define TRACE_LEVEL_DIR 1
+#endif
+#ifndef TRACE_LEVEL_IPC
+#define TRACE_LEVEL_IPC 1
+#endif
+
+/* Trace at a given level if the part it belongs to is traced at that level. */
+#define TRACE_CACHE(level, ...) \
+    do { if ((level) <= TRACE_LEVEL_CACHE) TracePrintf(level, __VA_ARGS__); } while (0)
+#define TRACE_ALLOC(level, ...) \
+    do { if ((level) <= TRACE_LEVEL_ALLOC) TracePrintf(level, __VA_ARGS__); } while (0)
+#define TRACE_DIR(level, ...) \
+    do { if ((level) <= TRACE_LEVEL_DIR) TracePrintf(level, __VA_ARGS__); } while (0)
+#define TRACE_IPC(level, ...) \
+    do { if ((level) <= TRACE_LEVEL_IPC) TracePrintf(level, __VA_ARGS__); } while (0)
+
+#endif /* _TRACE_H */
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <comp421/yalnix.h>
+#include <comp421/iolib.h>
+
+#include "message.h"
+
+/*
+ *  Lists a directory of NFILES entries with a buffer too small for more
+ *  than two records, so ReadDir must resume from the cookie of the last
+ *  record on each call, then Seeks back to a saved cookie and checks that
+ *  listing resumes from the same entry.
+ */
+
+#define NFILES	10
+
+int
+main()
+{
+	static char records[2 * sizeof(struct DirRecord)];
+	struct DirRecord *rec;
+	char name[16];
+	char resumed[DIRNAMELEN + 1];
+	int fd;
+	int nch;
+	int off;
+	int calls = 0;
+	int entries = 0;
+	int saved = -1;
+	int i;
+
+	MkDir("/rd");
+	for (i = 0; i < NFILES; i++) {
+		sprintf(name, "/rd/f%d", i);
+		Close(Create(name));
+	}
+
+	fd = Open("/rd");
+	printf("Open status %d\n", fd);
+
+	while ((nch = ReadDir(fd, records, sizeof(records))) > 0) {
+		calls++;
+		for (off = 0; off < nch; off += rec->reclen) {
+			rec = (struct DirRecord *)(records + off);
+			entries++;
+			if (entries == 4) {
+				saved = rec->cookie;
+			} else if (entries == 5) {
+				strcpy(resumed, rec->name);
+			}
+		}
+	}
+	printf("ReadDir status %d, %d entries in %d calls\n", nch, entries, calls);
+
+	Seek(fd, saved, SEEK_SET);
+	nch = ReadDir(fd, records, sizeof(records));
+	rec = (struct DirRecord *)records;
+	printf("Resumed from cookie %d at %s (expected %s)\n",
+	    saved, nch > 0 ? rec->name : "nothing", resumed);
+
+	Close(fd);
+	Shutdown();
+	return 0;
+}
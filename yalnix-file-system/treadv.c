@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <comp421/yalnix.h>
+#include <comp421/iolib.h>
+
+#include "message.h"
+
+/*
+ *  Writes a file through three buffers with one WriteV, reads it back
+ *  through buffers of other sizes with one ReadV, and checks that a list
+ *  of more than MAX_IOVECS buffers is refused.
+ */
+
+int
+main()
+{
+	static struct IoVec iov[MAX_IOVECS + 1];
+	char head[4], body[12], tail[8];
+	char first[10], second[14];
+	char one;
+	int fd;
+	int status;
+	int i;
+
+	fd = Create("/v");
+	printf("Create status %d\n", fd);
+
+	iov[0].base = "abcd";
+	iov[0].len = 4;
+	iov[1].base = "efghijklmnop";
+	iov[1].len = 12;
+	iov[2].base = "qrstuvwx";
+	iov[2].len = 8;
+	status = WriteV(fd, iov, 3);
+	printf("WriteV status %d\n", status);
+
+	Seek(fd, 0, SEEK_SET);
+	iov[0].base = first;
+	iov[0].len = sizeof(first);
+	iov[1].base = second;
+	iov[1].len = sizeof(second);
+	status = ReadV(fd, iov, 2);
+	printf("ReadV status %d: %.10s %.14s\n", status, first, second);
+
+	Seek(fd, 0, SEEK_SET);
+	iov[0].base = head;
+	iov[0].len = sizeof(head);
+	iov[1].base = body;
+	iov[1].len = sizeof(body);
+	iov[2].base = tail;
+	iov[2].len = sizeof(tail);
+	status = ReadV(fd, iov, 3);
+	printf("ReadV status %d: %s\n", status,
+	    (memcmp(head, "abcd", 4) == 0 && memcmp(body, "efghijklmnop", 12) == 0 &&
+	    memcmp(tail, "qrstuvwx", 8) == 0) ? "same" : "different");
+
+	for (i = 0; i < MAX_IOVECS + 1; i++) {
+		iov[i].base = &one;
+		iov[i].len = 1;
+	}
+	Seek(fd, 0, SEEK_SET);
+	status = ReadV(fd, iov, MAX_IOVECS + 1);
+	printf("ReadV of %d buffers status %d\n", MAX_IOVECS + 1, status);
+	status = WriteV(fd, iov, MAX_IOVECS + 1);
+	printf("WriteV of %d buffers status %d\n", MAX_IOVECS + 1, status);
+	status = ReadV(fd, iov, MAX_IOVECS);
+	printf("ReadV of %d buffers status %d\n", MAX_IOVECS, status);
+
+	Close(fd);
+	Shutdown();
+	return 0;
+}
@@ -0,0 +1,56 @@
+#include <stdio.h>
+
+#include <comp421/yalnix.h>
+#include <comp421/iolib.h>
+#include <comp421/filesystem.h>
+
+/*
+ *  Builds a chain of symbolic links /l1 -> /f, /l2 -> /l1, and so on, and
+ *  opens the file through every link of it. A chain of up to MAXSYMLINKS
+ *  links must resolve to the file, and a longer one must fail.
+ */
+
+int
+main()
+{
+	char name[16];
+	char target[16];
+	char buf[8];
+	int fd;
+	int status;
+	int opened = 0;
+	int i;
+
+	fd = Create("/f");
+	status = Write(fd, "chained", 7);
+	printf("Write status %d\n", status);
+	Close(fd);
+
+	for (i = 1; i <= MAXSYMLINKS + 1; i++) {
+		sprintf(name, "/l%d", i);
+		if (i == 1)
+			sprintf(target, "/f");
+		else
+			sprintf(target, "/l%d", i - 1);
+		status = SymLink(target, name);
+		if (status != 0)
+			printf("SymLink %s status %d\n", name, status);
+	}
+
+	for (i = 1; i <= MAXSYMLINKS + 1; i++) {
+		sprintf(name, "/l%d", i);
+		fd = Open(name);
+		status = (fd < 0) ? fd : Read(fd, buf, 7);
+		if (status == 7)
+			opened++;
+		else
+			printf("Open %s status %d, read status %d\n", name, fd, status);
+		if (fd >= 0)
+			Close(fd);
+	}
+	printf("Opened %d of %d chains, expected %d\n",
+	    opened, MAXSYMLINKS + 1, MAXSYMLINKS);
+
+	Shutdown();
+	return 0;
+}
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <comp421/yalnix.h>
+#include <comp421/iolib.h>
+
+/*
+ *  Two processes write the same file: the parent reads the file into its
+ *  buffer, a child writes the middle of it, and the parent must then read
+ *  the child's data rather than what it buffered before.
+ */
+
+int
+main()
+{
+	char buf[32];
+	int fd;
+	int status;
+	int tries;
+
+	fd = Create("/shared");
+	status = Write(fd, "parent1.........parent2.", 24);
+	printf("Write status %d\n", status);
+
+	Seek(fd, 0, SEEK_SET);
+	status = Read(fd, buf, 8);
+	printf("Read status %d: %.8s\n", status, buf);
+
+	fflush(stdout);
+	if (Fork() == 0) {
+		fd = Open("/shared");
+		Seek(fd, 8, SEEK_SET);
+		Write(fd, "child", 5);
+		Close(fd);
+		Exit(0);
+	}
+
+	for (tries = 0; tries < 20; tries++) {
+		Seek(fd, 8, SEEK_SET);
+		status = Read(fd, buf, 5);
+		if (status == 5 && memcmp(buf, "child", 5) == 0)
+			break;
+		Delay(1);
+	}
+	printf("Read status %d: %.5s\n", status, buf);
+
+	Seek(fd, 16, SEEK_SET);
+	status = Write(fd, "PARENT2!", 8);
+	printf("Write status %d\n", status);
+
+	Seek(fd, 0, SEEK_SET);
+	memset(buf, 0, sizeof(buf));
+	status = Read(fd, buf, sizeof(buf));
+	printf("Read status %d: %s\n", status, buf);
+
+	Close(fd);
+	Shutdown();
+	return 0;
+}
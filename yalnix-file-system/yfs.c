@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -7,6 +8,7 @@
 
 #include "hash_table.h"
 #include "message.h"
+#include "trace.h"
 #include "yfs.h"
 
 
@@ -23,9 +25,60 @@
 // Define a load factor for the hash tables
 #define LOADFACTOR 1.5 
 
-// Initialize pointers to the first free inode and block
-freeInode *firstFreeInode = NULL;
-freeBlock *firstFreeBlock = NULL;
+// Bitmaps of the free inodes and blocks, one bit per inode or block, set
+// while it is free, and the first word of each that may have a set bit
+uint64_t *freeInodeMap = NULL;
+uint64_t *freeBlockMap = NULL;
+int freeInodeMapWords = 0;
+int freeBlockMapWords = 0;
+int freeInodeHint = 0;
+int freeBlockHint = 0;
+
+// Both bitmaps live in one buffer laid out as on disk, the inode bitmap
+// first, in the freeMapBlocks blocks starting at freeMapStart; the blocks
+// changed since they were last written are flagged in freeMapDirty
+uint64_t *freeMaps = NULL;
+bool *freeMapDirty = NULL;
+int freeMapStart = 0;
+int freeMapBlocks = 0;
+
+// Windows of blocks reserved ahead of the files being written, indexed by
+// inode number modulo RESERVE_SLOTS, and their length in blocks
+blockReservation blockReservations[RESERVE_SLOTS];
+int reserveWindow = RESERVE_WINDOW;
+
+// Blocks allocated to files, the number of contiguous runs they form and
+// the number of files started, to measure fragmentation
+int allocatedBlockCount = 0;
+int allocatedExtentCount = 0;
+int allocatedFileCount = 0;
+
+// Directory name lookup cache, direct mapped by a hash of the parent inode
+// number and the name, and its hit and miss counts
+dcacheEntry dcache[DCACHE_SLOTS];
+int dcacheHits = 0;
+int dcacheMisses = 0;
+
+// Index within its directory of the entry getDirectoryEntry last returned,
+// for releaseDirEntry
+int dirEntryIndex = 0;
+// Whether getDirectoryEntry last gave up on a block of the directory that could 
+// not be cached, so that its NULL does not mean the name is not there
+bool dirEntryUncached = false;
+
+// Generation of each inode, from one counter advanced by every change to an
+// inode or to the names in a directory, and the request it last changed in,
+// for the leases on attributes that clients cache
+int *inodeGenerations = NULL;
+int *inodeChangedAt = NULL;
+int numGenerations = 0;
+int generationCount = 0;
+// Newest generation met by the current lookup, the request it changed in,
+// and the number of leases renewed and refused
+int lookupGeneration = 0;
+int lookupChangedAt = 0;
+int leaseRenewals = 0;
+int leaseRefusals = 0;
 
 // Initialize counts for the number of free inodes and blocks
 
@@ -35,15 +88,32 @@ int currentInode = ROOTINODE;
 
 int numSymLinks = 0;
 
-// Initialize queues and hash tables for caching inode and block data
+// Initialize the pools and hash table for caching block data; inodes are
+// used in place in their cached inode blocks. Metadata and file data are
+// cached in separate pools so that file I/O cannot evict the blocks that
+// path lookups need.
 
-queue *cacheInodeQueue;
-struct hash_table *inodeTable;
-int inodeCacheSize = 0;
-
-queue *cacheBlockQueue;
+cachePool cachePools[NUM_POOLS];
 struct hash_table *blockTable;
-int blockCacheSize = 0;
+
+// Replacement policy of the block cache, chosen at startup
+int cachePolicy = CACHE_LRU;
+
+// Number of requests served so far
+int requestCount = 0;
+
+// Sequential read detection for recently read files, indexed by inode
+// number modulo READAHEAD_SLOTS, and the number of blocks read ahead
+readAheadState readAheadStates[READAHEAD_SLOTS];
+int readAheadBlocks = 0;
+
+// Dirty cached blocks, so that Sync only visits what changed
+cacheItem *dirtyBlocks[BLOCK_CACHESIZE];
+int dirtyBlockCount = 0;
+
+// Blocks pinned on behalf of the current request, released when it is done
+cacheItem *requestPins[BLOCK_CACHESIZE];
+int requestPinCount = 0;
 
 
 /**
@@ -57,19 +127,12 @@ int blockCacheSize = 0;
 void 
 init(void) 
 {
-    cacheInodeQueue = malloc(sizeof(queue));
-    cacheInodeQueue->firstItem = NULL;
-    cacheInodeQueue->lastItem = NULL;
-    
-    cacheBlockQueue = malloc(sizeof(queue));
-    cacheBlockQueue->firstItem = NULL;
-    cacheBlockQueue->lastItem = NULL;
-    inodeTable = hash_table_create(LOADFACTOR, INODE_CACHESIZE + 1);
     blockTable = hash_table_create(LOADFACTOR, BLOCK_CACHESIZE + 1);
-    buildFreeInodeAndBlockLists();
+    initBlockArena();
+    buildFreeInodeAndBlockMaps();
     
     if (Register(FILE_SERVER) != 0) {
-        TracePrintf(1, "error registering file server as a service\n");
+        TRACE_IPC(1, "error registering file server as a service\n");
         Exit(1);
     };
     
@@ -79,6 +142,59 @@ init(void)
 /* Helper Functions */
 
 
+/**
+ * This function preallocates the frames and cache items of the block cache in 
+ * a single arena and splits them between the metadata and data pools, putting 
+ * every item on the list of free items of its pool. The frames are laid out back 
+ * to back on a cache line boundary, followed by the items, so the cache never 
+ * calls malloc or free for a block after startup.
+ * 
+ * Inputs: None.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+initBlockArena(void)
+{
+    char *arena = malloc(BLOCK_CACHESIZE * (BLOCKSIZE + sizeof(cacheItem)) + CACHELINESIZE);
+    if (arena == NULL) {
+        TRACE_CACHE(1, "error allocating the block cache\n");
+        Exit(1);
+    }
+    
+    // Round the start of the frames up to the next cache line.
+    char *frames = (char *)(((uintptr_t)arena + CACHELINESIZE - 1) & ~(uintptr_t)(CACHELINESIZE - 1));
+    cacheItem *items = (cacheItem *)(frames + BLOCK_CACHESIZE * BLOCKSIZE);
+    
+    // The metadata pool takes the first frames and the data pool the rest.
+    int capacities[NUM_POOLS] = { METADATA_CACHESIZE, DATA_CACHESIZE };
+    int first = 0;
+    int p;
+    for (p = 0; p < NUM_POOLS; p++) {
+        cachePool *pool = &cachePools[p];
+        memset(pool, 0, sizeof(cachePool));
+        pool->blockQueue = malloc(sizeof(queue));
+        pool->blockQueue->firstItem = NULL;
+        pool->blockQueue->lastItem = NULL;
+        pool->probationQueue = malloc(sizeof(queue));
+        pool->probationQueue->firstItem = NULL;
+        pool->probationQueue->lastItem = NULL;
+        pool->capacity = capacities[p];
+        pool->items = items + first;
+        
+        // Push the items in reverse so that frames are handed out in address order.
+        int i;
+        for (i = first + pool->capacity - 1; i >= first; i--) {
+            items[i].addr = frames + i * BLOCKSIZE;
+            items[i].pool = pool;
+            items[i].nextItem = pool->freeItems;
+            pool->freeItems = &items[i];
+        }
+        first += pool->capacity;
+    }
+}
+
 /**
  * This function removes the first item from the specified queue and 
  * returns a pointer to it.
@@ -127,14 +243,14 @@ void
 printQueue(queue *queue)
 {
     cacheItem *item = queue->firstItem; // Initialize a pointer to the first item in the queue.
-    TracePrintf(1, "-----------------------\n"); // Print a separator to the console.
+    TRACE_CACHE(3, "-----------------------\n"); // Print a separator to the console.
     while (item != NULL) { // Iterate over each item in the queue.
-        TracePrintf(1, "%d\n", item->number); // Print the item's number to the console.
+        TRACE_CACHE(3, "%d\n", item->number); // Print the item's number to the console.
         item = item->nextItem; // Move the pointer to the next item in the queue.
     }
     if (queue->lastItem != NULL) // If the last item in the queue is not NULL:
-        TracePrintf(1, "last item = %d\n", queue->lastItem->number); // Print the number of the last item to the console.
-    TracePrintf(1, "-----------------------\n"); // Print a separator to the console.
+        TRACE_CACHE(3, "last item = %d\n", queue->lastItem->number); // Print the number of the last item to the console.
+    TRACE_CACHE(3, "-----------------------\n"); // Print a separator to the console.
 }
 
 /**
@@ -178,7 +294,6 @@ addItemEndQueue(cacheItem *item, queue *queue)
 {
     // if the queue is empty
     if (queue->firstItem == NULL) {
-        if (queue == cacheBlockQueue)
         item->nextItem = NULL;
         item->prevItem = NULL;
         queue->lastItem = item;
@@ -220,485 +335,1724 @@ isEqual(char *path, char dirEntryName[])
 }
 
 /**
- * This function marks the cache item associated with the given block number as dirty.
+ * This function marks a cached block as dirty and, if it was clean, adds it to the 
+ * end of the dirty block list.
  * 
  * Inputs:
- *  blockNumber: an integer representing the block number to.
+ *  item: a pointer to the cache item to mark as dirty.
  * 
  * Outputs: None.
- *  
+ * 
  */
 void
-saveBlock(int blockNumber) 
+markDirty(cacheItem *item)
 {
-    // Lookup the block item ptr in the hashmap.
-    cacheItem *blockItem = (cacheItem *)hash_table_lookup(blockTable, blockNumber);
-    // Mark block item as dirty.
-    blockItem->dirty = true;
+    if (item->dirty) {
+        return;
+    }
+    item->dirty = true;
+    item->dirtyIndex = dirtyBlockCount;
+    dirtyBlocks[dirtyBlockCount++] = item;
 }
 
 /**
- * This function is used to retrieve a block of data either from the cache or from 
- * disk if the block is not already in the cache. 
+ * This function marks a cached block as clean and, if it was dirty, removes it from 
+ * the dirty block list by moving the last item of the list into its place.
  * 
  * Inputs:
- *  blockNumber: an integer representing the block number to retrieve from cache or disk.
+ *  item: a pointer to the cache item to mark as clean.
  * 
- * Outputs: 
- *  A pointer to the requested block of data.
+ * Outputs: None.
  * 
  */
-void *
-getBlock(int blockNumber) 
+void
+markClean(cacheItem *item)
 {
-    //TracePrintf(1, "GETTING BLOCK #%d\n", blockNumber);
-    // First check to see if Block is in the cache using hashmap
-    // If it is, remove it from the middle of the block queue add it to the front
-    // return the pointer to it
-    cacheItem *blockItem = (cacheItem *)hash_table_lookup(blockTable, blockNumber);
-    
-    if (blockItem != NULL) {
-        removeItemFromQueue(cacheBlockQueue, blockItem);
-        addItemEndQueue(blockItem, cacheBlockQueue);
-        return blockItem->addr;
-    }
-    
-    // If the block is not in the cache
-    
-    // If the cache is full, remove the LRU block from the end of the queue, 
-    // and get the block number
-    // Use the block number to remove it from the hashmap
-    if (blockCacheSize == BLOCK_CACHESIZE) {
-        cacheItem *lruBlockItem = removeItemFromFrontOfQueue(cacheBlockQueue);
-        int lruBlockNum = lruBlockItem->number;
-        WriteSector(lruBlockNum, lruBlockItem->addr);
-        blockCacheSize--;
-        hash_table_remove(blockTable, lruBlockNum, NULL, NULL);
-        destroyCacheItem(lruBlockItem);
+    if (!item->dirty) {
+        return;
     }
-    
-    // Allocate space for the new block, read it from disk. 
-    // Add the new block to the front of the LRU queue and add it to the 
-    // hashmap and then return the pointer to the new block.
-    void *block = malloc(BLOCKSIZE);
-    ReadSector(blockNumber, block);
-    cacheItem *newItem = malloc(sizeof(cacheItem));
-    newItem->number = blockNumber;
-    newItem->addr = block;
-    newItem->dirty = false;
-    
-    addItemEndQueue(newItem, cacheBlockQueue);
-    blockCacheSize++;
-    hash_table_insert(blockTable, blockNumber, newItem);
-    return block;
+    item->dirty = false;
+    cacheItem *lastItem = dirtyBlocks[--dirtyBlockCount];
+    dirtyBlocks[item->dirtyIndex] = lastItem;
+    lastItem->dirtyIndex = item->dirtyIndex;
 }
 
 /**
- * This function checks marks the inode as dirty in the cache.
+ * This function pins a cached block until the end of the current request, so that 
+ * it cannot be evicted while pointers into it are in use. A block is pinned at most 
+ * once per request no matter how many times it is asked for.
  * 
  * Inputs:
- *  inodeNum: An integer representing the inode number of the inode that needs 
- *  to be marked as dirty in the cache.
+ *  item: a pointer to the cache item to pin.
  * 
  * Outputs: None.
  * 
  */
 void
-saveInode(int inodeNum) 
+pinForRequest(cacheItem *item)
 {
+    if (item->requestPinned) {
+        return;
+    }
+    item->requestPinned = true;
+    item->pins++;
+    requestPins[requestPinCount++] = item;
+}
 
-    // Lookup the inode ptr in the hashmap.
-    cacheItem *inodeItem = (cacheItem *)hash_table_lookup(inodeTable, inodeNum);
-    
-    // Mark the inode as dirty.
-    inodeItem->dirty = true;
+/**
+ * This function drops every pin taken by pinForRequest since the last call, making 
+ * those blocks evictable again. It is called once each request has been served.
+ * 
+ * Inputs: None.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+releaseRequestPins(void)
+{
+    while (requestPinCount > 0) {
+        cacheItem *item = requestPins[--requestPinCount];
+        item->requestPinned = false;
+        item->pins--;
+    }
 }
 
 /**
- * This function retrieves an inode from the inode cache or disk, depending on 
- * whether or not the inode is currently cached. If the inode is cached, it is 
- * removed from its position in the cache queue and added to the front, and the 
- * pointer to the inode is returned. If the inode is not cached, the least recently 
- * used inode is removed from the cache, its contents are saved to disk, and the new 
- * inode is read from disk and added to the cache. Finally, a pointer to the 
- * newly-cached inode is returned.
+ * This function reads a block into the cache if needed and pins it there, so that 
+ * the returned pointer stays valid across calls that may evict other blocks. Every 
+ * pinBlock must be matched by an unpinBlock of the same block number.
  * 
  * Inputs:
- *  inodeNum: an integer representing the inode number of the inode to be retrieved.
+ *  blockNumber: an integer representing the block number to pin.
+ *  type: METADATA_POOL or DATA_POOL, the cache pool the block belongs in.
  * 
  * Outputs: 
- *  A pointer to a struct inode, representing the retrieved inode.
+ *  A pointer to the pinned block of data, or NULL if every frame of its pool is 
+ *  already pinned.
  * 
  */
-struct inode*
-getInode(int inodeNum) 
+void *
+pinBlock(int blockNumber, int type)
 {
-    // First, check to see if inode is in the cache using hashmap
-    // If it is, remove it from the middle of the inode queue and add it to the front
-    // return the pointer to the inode
-    cacheItem *nodeItem = (cacheItem *)hash_table_lookup(inodeTable, inodeNum);
-    if (nodeItem != NULL) {
-        removeItemFromQueue(cacheInodeQueue, nodeItem);
-        addItemEndQueue(nodeItem, cacheInodeQueue);
-        return nodeItem->addr;
-    }
-    
-    // If the cache is full:
-        // Get the lru inode in the cache, remove it from the hashmap.
-        // Get the block number corresponding to lru inode.
-        // Get the block corresponding to this block number.
-        // Get the correct address corresponding to this inode within that block.
-        // Copy the contents of the lru inode into this address.
-        // Call save block on that block.
-    if (inodeCacheSize == INODE_CACHESIZE) {
-        cacheItem *lruInode = removeItemFromFrontOfQueue(cacheInodeQueue);
-        int lruInodeNum = lruInode->number;
-        inodeCacheSize--;
-        hash_table_remove(inodeTable, lruInodeNum, NULL, NULL);
-        int lruBlockNum = (lruInodeNum / INODESPERBLOCK) + 1;
-        
-        void *lruBlock = getBlock(lruBlockNum);
-        void *inodeAddrInBlock = (lruBlock + (lruInodeNum - (lruBlockNum - 1) * INODESPERBLOCK) * INODESIZE);
-        
-        memcpy(inodeAddrInBlock, lruInode->addr, sizeof(struct inode));
-        saveBlock(lruBlockNum);
-        
-        destroyCacheItem(lruInode);
+    cacheItem *blockItem = getBlockItem(blockNumber, type);
+    if (blockItem == NULL) {
+        return NULL;
     }
-    
-    // Get the block number corresponding to this new inode.
-    int blockNum = (inodeNum / INODESPERBLOCK) + 1;
-    
-    // Get the block address for this inode.
-    void *blockAddr = getBlock(blockNum);
-    
-    // Look up the inodes address within the block.
-    struct inode *newInodeAddrInBlock = (struct inode *)(blockAddr + (inodeNum - (blockNum - 1) * INODESPERBLOCK) * INODESIZE);
-    
-    // Copy the contents of the inode into a newly allocated inode.
-    struct inode *inodeCpy = malloc(sizeof(struct inode));
-    struct cacheItem *inodeItem = malloc(sizeof(struct cacheItem));
-    memcpy(inodeCpy, newInodeAddrInBlock, sizeof(struct inode));
-    inodeItem->addr = inodeCpy;
-    inodeItem->number = inodeNum;
-    
-    // Add this inode to the front of the LRU queue and add it to the hashmap.
-    addItemEndQueue(inodeItem, cacheInodeQueue);
-    inodeCacheSize++;
-    hash_table_insert(inodeTable, inodeNum, inodeItem);
-    
-    // Return the address of the new inode.
-    return inodeItem->addr;
+    blockItem->pins++;
+    return blockItem->addr;
 }
 
 /**
- * This function deallocates the memory allocated for a cache item. 
- * It takes a pointer to a cache item as input and frees the memory allocated for 
- * the address of the inode stored in the cache item and the cache item itself.
+ * This function drops one pin taken on a block by pinBlock. Once a block has no pins 
+ * left it can be evicted again.
  * 
  * Inputs:
- *  item: A pointer to the cache item that needs to be deallocated.
+ *  blockNumber: an integer representing the block number to unpin.
  * 
  * Outputs: None.
  * 
  */
 void
-destroyCacheItem(cacheItem *item) 
+unpinBlock(int blockNumber)
 {
-    free(item->addr);
-    free(item);
+    cacheItem *blockItem = (cacheItem *)hash_table_lookup(blockTable, blockNumber);
+    if (blockItem == NULL || blockItem->pins == 0) {
+        TRACE_CACHE(1, "unpinning block %d that is not pinned\n", blockNumber);
+        return;
+    }
+    blockItem->pins--;
 }
 
 /**
- * This function calculates the block number that contains the specified inode 
- * by dividing the inode number by the number of inodes per block (INODESPERBLOCK) 
- * and adding 1. It then calls the getBlock() function to retrieve a pointer to 
- * the data block that contains the specified inode. The retrieved pointer is then 
- * returned as the output of the function.
+ * This function compares two cache items by their block or inode number, for 
+ * sorting with qsort.
  * 
  * Inputs:
- *  inodeNumber: an integer representing the inode number for which we want 
- *  to retrieve the block.
+ *  a: a pointer to a pointer to the first cache item.
+ *  b: a pointer to a pointer to the second cache item.
  * 
  * Outputs: 
- *  A pointer to the block of data that contains the specified inode.
+ *  A negative, zero or positive integer as the first number is less than, equal 
+ *  to or greater than the second.
  * 
  */
-void *
-getInodeBlockNum(int inodeNumber) 
+int
+compareCacheItems(const void *a, const void *b)
 {
-    // Calculate and return block number.
-    int blockNumber = (inodeNumber / INODESPERBLOCK) + 1;
-    return getBlock(blockNumber);
+    return (*(cacheItem * const *)a)->number - (*(cacheItem * const *)b)->number;
 }
 
 /**
- * This function takes an inode and an index n, and returns the block number of the 
- * nth block of the file, allocating the block if necessary and if the 
- * allocateIfNeeded parameter is true.
+ * This function marks the cache item associated with the given block number as dirty.
  * 
  * Inputs:
- *  inode: a pointer to a struct inode representing the file
- *  n: an integer representing the index of the block to retrieve
- *  allocateIfNeeded: a boolean indicating whether to allocate a new block if necessary
- * 
- * Outputs: 
- *  An integer representing the block number of the nth block of the file.
- *  Returns 0 if the given index is invalid or if the block could not be allocated.
+ *  blockNumber: an integer representing the block number to.
  * 
+ * Outputs: None.
+ *  
  */
-int
-getNthBlock(struct inode *inode, int n, bool allocateIfNeeded) 
+void
+saveBlock(int blockNumber) 
 {
-    bool isOver = false;
-    if (n >= NUM_DIRECT + BLOCKSIZE / (int)sizeof(int)) {
-        return 0;
-    }
-    if (n*BLOCKSIZE >= inode->size) 
-    {
-        isOver = true;
-    }
-    if (isOver && !allocateIfNeeded) {
-        return 0;
-    }
-    if (n < NUM_DIRECT) {
-        if (isOver) {
-            inode->direct[n] = getNextFreeBlockNum();
-        }
-        // if getNextFreeBlockNum returned 0, return 0
-        return inode->direct[n];
-    } 
-    //search the direct blocks
-    int *indirectBlock = getBlock(inode->indirect);
-    if (isOver) {
-        // if getNextFreeBlockNum returned 0, return 0
-        indirectBlock[n - NUM_DIRECT] = getNextFreeBlockNum();
-    }
-    int blockNum = indirectBlock[n - NUM_DIRECT];
-    return blockNum;
+    // Lookup the block item ptr in the hashmap.
+    cacheItem *blockItem = (cacheItem *)hash_table_lookup(blockTable, blockNumber);
+    // Mark block item as dirty.
+    markDirty(blockItem);
 }
 
 /**
- * This function takes a path and the inode number for the starting directory, 
- * and returns the inode number for the file or directory represented by the path.
+ * This function writes a dirty cached block back to disk along with the run of 
+ * dirty cached blocks on either side of it, up to WRITEBACK_CLUSTER blocks in all. 
+ * The run is written in ascending sector order and each block in it is marked clean 
+ * once it has been written. The run stops at the first write that fails, leaving that 
+ * block and the rest of the run dirty, as yfsSync does.
  * 
  * Inputs:
- *  path: the file path to get the inode number for.
- *  inodeStartNumber: the inode to start looking for the next part of the file path in.
+ *  item: a pointer to the dirty cache item to write back; it must still be in blockTable.
  * 
  * Outputs: 
- *  The inode number of the path, or 0 if it's an invalid path.
+ *  Upon success, returns 0. Otherwise, returns ERROR if a block of the run could not 
+ *  be written, in which case item may still be dirty.
  * 
  */
 int
-getPathInodeNumber(char *path, int inodeStartNumber)
+writeBackCluster(cacheItem *item)
 {
-    
-    // Get the inode number for the first file in path 
-    int nextInodeNumber = 0;
-
-    // Get inode corresponding to inodeStartNumber
-    void *block = getInodeBlockNum(inodeStartNumber);
-    struct inode *inode = getInode(inodeStartNumber);
-    if (inode->type == INODE_DIRECTORY) {
-        // go get the directory entry in this directory
-        // that has that name
-        int blockNum;
-        int offset = getDirectoryEntry(path, inodeStartNumber, &blockNum, false);
-        if (offset != -1) {
-            block = getBlock(blockNum);
-            struct dir_entry * dir_entry = (struct dir_entry *) ((char *) block + offset);
-            nextInodeNumber = dir_entry->inum;
-        }
-    } else if (inode->type == INODE_REGULAR) {
-        return 0;
-    } else if (inode->type == INODE_SYMLINK) {
-        return 0;
-    }
-    char *nextPath = path;
-    if (nextInodeNumber == 0) {
-        // Return error
-        return 0;
-    }
-    while (nextPath[0] != '/') {
-        // base case
-        if (nextPath[0] == '\0') {
-            inode = getInode(nextInodeNumber);
-            //TracePrintf(1, "are we a symlink?\n");
-            if (inode->type != INODE_SYMLINK) {
-                return nextInodeNumber;
-            }
-            else {
-                nextPath = path;
-                break;
-            }
-        }
-        nextPath += sizeof (char);
-    }
-    while (nextPath[0] == '/') {
-        nextPath += sizeof (char);
+    // Grow the run downwards, then upwards, while the neighbours are cached and dirty.
+    int first = item->number;
+    int last = item->number;
+    cacheItem *neighbor;
+    while (last - first + 1 < WRITEBACK_CLUSTER
+            && (neighbor = (cacheItem *)hash_table_lookup(blockTable, first - 1)) != NULL
+            && neighbor->dirty) {
+        first--;
     }
-    if (nextPath[0] == '\0') {
-        return nextInodeNumber;
+    while (last - first + 1 < WRITEBACK_CLUSTER
+            && (neighbor = (cacheItem *)hash_table_lookup(blockTable, last + 1)) != NULL
+            && neighbor->dirty) {
+        last++;
     }
-    inode = getInode(nextInodeNumber);
-    if (inode->type == INODE_SYMLINK) {
-        numSymLinks++;
-        if (numSymLinks > MAXSYMLINKS) {
-            return 0;
-        }
-        int dataBlockNum = inode->direct[0];
-        char *dataBlock = (char *)getBlock(dataBlockNum);
-        if (dataBlock[0] == '/') {
-            dataBlock += sizeof(char);
-            inodeStartNumber = ROOTINODE;
-        }
-        nextInodeNumber = getPathInodeNumber(dataBlock, inodeStartNumber);
-        while (nextPath[0] != '/') {
-            if (nextPath[0] == '\0') {
-                return nextInodeNumber;
-            }
-            nextPath += sizeof (char);
+    
+    // Write the whole run in one sequential sweep.
+    int blockNum;
+    for (blockNum = first; blockNum <= last; blockNum++) {
+        cacheItem *runItem = (cacheItem *)hash_table_lookup(blockTable, blockNum);
+        if (WriteSector(blockNum, runItem->addr) != 0) {
+            TRACE_CACHE(1, "error writing block %d\n", blockNum);
+            return ERROR;
         }
-        while (nextPath[0] == '/')
-            nextPath += sizeof(char);        
+        markClean(runItem);
     }
-    return getPathInodeNumber(nextPath, nextInodeNumber);
+    return 0;
 }
 
 /**
- * This function marks the given inode number as free by modifying its type to 
- * INODE_FREE, and adds the inode number to the list of free inodes.
+ * This function returns the least recently used block in the given queue that is 
+ * not pinned.
  * 
  * Inputs:
- *  inodeNum: an integer representing the inode number to be marked as free.
+ *  queue: a pointer to the queue to search, least recently used block first.
  * 
- * Outputs: None.
+ * Outputs: 
+ *  A pointer to the first unpinned cache item in the queue, or NULL if there is none.
  * 
  */
-void
-freeUpInode(int inodeNum) 
+cacheItem *
+findUnpinnedItem(queue *queue)
 {
-    // Get address of this inode. 
-    struct inode *inode = getInode(inodeNum);
-    
-    // Modify the type of inode to free.
-    inode->type = INODE_FREE;
-
-    addFreeInodeToList(inodeNum);
-
-    saveInode(inodeNum);
+    cacheItem *item = queue->firstItem;
+    while (item != NULL && item->pins > 0) {
+        item = item->nextItem;
+    }
+    return item;
 }
 
 /**
- * This function gets the number of the next free inode in the file system, and 
- * updates the inode structure for that inode to indicate it has been reused.
+ * This function sweeps the CLOCK hand of a pool over its frames, clearing the 
+ * reference bit of each unpinned block it passes, and stops at the first unpinned 
+ * block whose bit was already clear. A block used since the hand last passed it 
+ * thus gets a second chance before it is evicted.
  * 
- * Inputs: None.  
+ * Inputs:
+ *  pool: a pointer to the cache pool to sweep.
  * 
  * Outputs: 
- *  The number of the next free inode in the file system, or 0 if there are 
- *  no free inodes left.
+ *  A pointer to the cache item to reuse, or NULL if every block in the pool is pinned.
  * 
  */
-int 
-getNextFreeInodeNum(void) 
+cacheItem *
+sweepClock(cachePool *pool)
 {
-    // Check if there are free inodes left
-    if (firstFreeInode == NULL) {
-        return 0;
+    // Two full turns clear every reference bit, so a third cannot find anything new.
+    int i;
+    for (i = 0; i < 2 * pool->capacity; i++) {
+        cacheItem *item = &pool->items[pool->clockHand];
+        pool->clockHand = (pool->clockHand + 1) % pool->capacity;
+        if (item->pins > 0) {
+            continue;
+        }
+        if (!item->referenced) {
+            return item;
+        }
+        item->referenced = false;
     }
-
-    // Get the inode number of the first free inode in the linked list
-    int inodeNum = firstFreeInode->inodeNumber;
-    // Get the inode structure for the inode number
-    struct inode *inode = getInode(inodeNum);
-    // Increment the reuse counter to indicate that the inode has been reused
-    inode->reuse++;
-    // Save the inode structure to disk
-    saveInode(inodeNum);
-    // Remove the first free inode from the linked list
-    firstFreeInode = firstFreeInode->next;
-    // Return the inode number of the reused inode
-    return inodeNum;
+    return NULL;
 }
 
 /**
- * This function adds a new freeInode to the beginning of the linked 
- * list of free inodes.
+ * This function picks the block to evict from a full pool and takes it off its 
+ * queue. Under LRU this is the least recently used unpinned block. Under 2Q it is 
+ * the oldest block on probation once the probation queue has grown past a quarter 
+ * of the pool, so that a long scan only cycles through probation and leaves the 
+ * blocks in the pool's block queue alone; its number is remembered as a ghost. 
+ * Under CLOCK blocks are not kept on a queue and the choice is left to sweepClock.
  * 
  * Inputs:
- *  inodeNum: an integer representing the inode number of the inode 
- *  that is being added to the list of free inodes.
+ *  pool: a pointer to the cache pool to evict from.
+ * 
+ * Outputs: 
+ *  A pointer to the cache item to reuse, or NULL if every block in the pool is pinned.
  * 
- * Outputs: None.  
  */
-void 
-addFreeInodeToList(int inodeNum) 
+cacheItem *
+chooseVictim(cachePool *pool)
 {
-    // Allocate memory for a new freeInode struct and initialize its values
-    freeInode *newHead = malloc(sizeof(freeInode));
-    newHead->inodeNumber = inodeNum;
-    newHead->next = firstFreeInode;
-
-    // Update the linked list with the new head node
-    firstFreeInode = newHead;
-    freeInodeCount++;
-}
-
-/**
- * This function returns the number of the next free block and updates 
- * the free list accordingly.
+    if (cachePolicy == CACHE_CLOCK) {
+        return sweepClock(pool);
+    }
+    
+    cacheItem *victim = NULL;
+    if (pool->probationSize > pool->capacity / 4) {
+        victim = findUnpinnedItem(pool->probationQueue);
+    }
+    if (victim == NULL) {
+        victim = findUnpinnedItem(pool->blockQueue);
+    }
+    if (victim == NULL) {
+        victim = findUnpinnedItem(pool->probationQueue);
+    }
+    if (victim == NULL) {
+        return NULL;
+    }
+    
+    if (victim->onProbation) {
+        removeItemFromQueue(pool->probationQueue, victim);
+        pool->probationSize--;
+        pool->ghostBlocks[pool->ghostNext] = victim->number;
+        pool->ghostNext = (pool->ghostNext + 1) % GHOST_SIZE;
+    } else {
+        removeItemFromQueue(pool->blockQueue, victim);
+    }
+    return victim;
+}
+
+/**
+ * This function checks whether a block was recently evicted from the 2Q probation 
+ * queue of a pool, and forgets it if so.
+ * 
+ * Inputs:
+ *  pool: a pointer to the cache pool whose ghosts to search.
+ *  blockNumber: an integer representing the block number to look for.
+ * 
+ * Outputs: 
+ *  Returns true if the block number was remembered as a ghost. Otherwise, returns false.
+ * 
+ */
+bool
+forgetGhost(cachePool *pool, int blockNumber)
+{
+    int i;
+    for (i = 0; i < GHOST_SIZE; i++) {
+        if (pool->ghostBlocks[i] == blockNumber) {
+            pool->ghostBlocks[i] = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * This function is used to retrieve the cache item of a block either from the cache 
+ * or from disk if the block is not already in the cache. A block that is read from 
+ * disk goes into the pool for its type and can only evict blocks of that pool, and 
+ * blocks that are pinned are never chosen for eviction. A block that is already 
+ * cached is used from whichever pool it is in.
+ * 
+ * Inputs:
+ *  blockNumber: an integer representing the block number to retrieve from cache or disk.
+ *  type: METADATA_POOL for inode, directory, indirect and symbolic link blocks, or 
+ *  DATA_POOL for the data blocks of regular files.
+ * 
+ * Outputs: 
+ *  A pointer to the cache item holding the requested block, or NULL if the block 
+ *  is not cached and every frame in its pool is pinned.
+ * 
+ */
+cacheItem *
+getBlockItem(int blockNumber, int type) 
+{
+    //TracePrintf(1, "GETTING BLOCK #%d\n", blockNumber);
+    // First check to see if Block is in the cache using hashmap
+    // If it is, remove it from the middle of the block queue add it to the front
+    // return the pointer to it
+    // A block on 2Q probation moves to the block queue only once a later request
+    // uses it again, so the repeated uses of a block within one request, such as 
+    // a long Read, do not make a scanned block look hot
+    cacheItem *blockItem = (cacheItem *)hash_table_lookup(blockTable, blockNumber);
+    
+    // Under CLOCK a hit only sets the block's reference bit.
+    // The first hit on a block read ahead counts as its first use.
+    if (blockItem != NULL) {
+        cachePool *pool = blockItem->pool;
+        pool->hits++;
+        if (blockItem->readAhead) {
+            blockItem->readAhead = false;
+            blockItem->firstRequest = requestCount;
+        }
+        if (cachePolicy == CACHE_CLOCK) {
+            blockItem->referenced = true;
+        } else if (!blockItem->onProbation) {
+            removeItemFromQueue(pool->blockQueue, blockItem);
+            addItemEndQueue(blockItem, pool->blockQueue);
+        } else if (blockItem->firstRequest != requestCount) {
+            removeItemFromQueue(pool->probationQueue, blockItem);
+            pool->probationSize--;
+            blockItem->onProbation = false;
+            addItemEndQueue(blockItem, pool->blockQueue);
+        }
+        return blockItem;
+    }
+    
+    // If the block is not in the cache, give it a frame and read it from disk.
+    cachePools[type].misses++;
+    cacheItem *newItem = allocateCacheItem(blockNumber, type);
+    if (newItem == NULL) {
+        return NULL;
+    }
+    ReadSector(blockNumber, newItem->addr);
+    return newItem;
+}
+
+/**
+ * This function gives a block that is not cached a frame in the pool for its type, 
+ * evicting a block of that pool if it is full, and adds it to the cache without 
+ * reading it from disk. The contents of the frame are left as they are.
+ * 
+ * Inputs:
+ *  blockNumber: an integer representing the block number to add to the cache.
+ *  type: METADATA_POOL or DATA_POOL, the cache pool the block belongs in.
+ * 
+ * Outputs: 
+ *  A pointer to the cache item for the block, or NULL if every frame in its pool 
+ *  is pinned.
+ * 
+ */
+cacheItem *
+allocateCacheItem(int blockNumber, int type)
+{
+    cachePool *pool = &cachePools[type];
+    
+    // If the pool is full, take the victim chosen by the replacement policy 
+    // off its queue, and get the block number
+    // Use the block number to remove it from the hashmap
+    // and reuse its item and frame for the new block.
+    // Otherwise take an unused item of the pool from the arena.
+    // Only a dirty victim is written back, together with the dirty
+    // blocks cached next to it on disk.
+    cacheItem *newItem;
+    if (pool->size == pool->capacity) {
+        newItem = chooseVictim(pool);
+        if (newItem == NULL) {
+            TRACE_CACHE(1, "every cached block is pinned, cannot read block %d\n", blockNumber);
+            return NULL;
+        }
+        int lruBlockNum = newItem->number;
+        if (newItem->dirty && writeBackCluster(newItem) == ERROR) {
+            // Keep a victim that could not be written back, which holds the 
+            // only copy of its block, and put it back on its queue.
+            TRACE_CACHE(1, "cannot evict block %d, cannot read block %d\n", lruBlockNum, blockNumber);
+            if (cachePolicy != CACHE_CLOCK) {
+                newItem->onProbation = false;
+                addItemEndQueue(newItem, pool->blockQueue);
+            }
+            return NULL;
+        }
+        pool->size--;
+        hash_table_remove(blockTable, lruBlockNum, NULL, NULL);
+    } else {
+        newItem = pool->freeItems;
+        pool->freeItems = pool->freeItems->nextItem;
+    }
+    
+    // Add the new block to the back of its queue and add it to the 
+    // hashmap and then return the new block's item. Under 2Q the block 
+    // starts on probation unless it was evicted from probation recently.
+    newItem->number = blockNumber;
+    newItem->dirty = false;
+    newItem->pins = 0;
+    newItem->requestPinned = false;
+    newItem->onProbation = (cachePolicy == CACHE_2Q && !forgetGhost(pool, blockNumber));
+    newItem->firstRequest = requestCount;
+    newItem->referenced = true;
+    newItem->readAhead = false;
+    
+    // Under CLOCK the frame is only ever found through the pool's items.
+    if (newItem->onProbation) {
+        addItemEndQueue(newItem, pool->probationQueue);
+        pool->probationSize++;
+    } else if (cachePolicy != CACHE_CLOCK) {
+        addItemEndQueue(newItem, pool->blockQueue);
+    }
+    pool->size++;
+    hash_table_insert(blockTable, blockNumber, newItem);
+    return newItem;
+}
+
+/**
+ * This function returns a zeroed cache frame for a block whose old contents are 
+ * not needed, such as a block that was just allocated or one that is about to be 
+ * overwritten whole, without reading the block from disk. The caller fills the 
+ * frame and then marks it dirty with saveBlock.
+ * 
+ * Inputs:
+ *  blockNumber: an integer representing the block number to get a frame for.
+ *  type: METADATA_POOL or DATA_POOL, the cache pool the block belongs in.
+ * 
+ * Outputs: 
+ *  A pointer to the zeroed frame of the block, or NULL if it cannot be cached.
+ * 
+ */
+void *
+getNewBlock(int blockNumber, int type)
+{
+    cacheItem *blockItem = (cacheItem *)hash_table_lookup(blockTable, blockNumber);
+    if (blockItem == NULL) {
+        blockItem = allocateCacheItem(blockNumber, type);
+        if (blockItem == NULL) {
+            return NULL;
+        }
+    }
+    memset(blockItem->addr, 0, BLOCKSIZE);
+    return blockItem->addr;
+}
+
+/**
+ * This function is used to retrieve a block of data either from the cache or from 
+ * disk if the block is not already in the cache. 
+ * 
+ * Inputs:
+ *  blockNumber: an integer representing the block number to retrieve from cache or disk.
+ *  type: METADATA_POOL or DATA_POOL, the cache pool the block belongs in.
+ * 
+ * Outputs: 
+ *  A pointer to the requested block of data, or NULL if it cannot be cached.
+ * 
+ */
+void *
+getBlock(int blockNumber, int type) 
+{
+    cacheItem *blockItem = getBlockItem(blockNumber, type);
+    if (blockItem == NULL) {
+        return NULL;
+    }
+    return blockItem->addr;
+}
+
+/**
+ * This function checks marks the inode as dirty in the cache, by marking the 
+ * cached inode block that holds it as dirty.
+ * 
+ * Inputs:
+ *  inodeNum: An integer representing the inode number of the inode that needs 
+ *  to be marked as dirty in the cache.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+saveInode(int inodeNum) 
+{
+    // Mark the block holding the inode as dirty.
+    saveBlock((inodeNum / INODESPERBLOCK) + 1);
+    // Leases on the old attributes of the inode are stale now.
+    changeGeneration(inodeNum);
+}
+
+/**
+ * This function retrieves an inode from the block cache, reading its inode block 
+ * from disk if that block is not cached. The inode is used in place inside its 
+ * inode block, which stays pinned in the cache until the end of the current request, 
+ * so the returned pointer remains valid while the request is being served and 
+ * changes made through it only need a saveInode call to reach the disk.
+ * 
+ * Inputs:
+ *  inodeNum: an integer representing the inode number of the inode to be retrieved.
+ * 
+ * Outputs: 
+ *  A pointer to a struct inode, representing the retrieved inode, or NULL if its 
+ *  inode block is not cached and every frame of the metadata pool is pinned, or if 
+ *  the request already holds REQUEST_PIN_MAX inode blocks pinned.
+ * 
+ */
+struct inode*
+getInode(int inodeNum) 
+{
+    // Get the block number corresponding to this inode.
+    int blockNum = (inodeNum / INODESPERBLOCK) + 1;
+    
+    // Get the inode block and pin it for the rest of the request.
+    cacheItem *blockItem = getBlockItem(blockNum, METADATA_POOL);
+    if (blockItem == NULL) {
+        return NULL;
+    }
+    if (!blockItem->requestPinned && requestPinCount >= REQUEST_PIN_MAX) {
+        TRACE_CACHE(1, "request holds %d inode blocks, cannot pin block %d\n", requestPinCount, blockNum);
+        return NULL;
+    }
+    pinForRequest(blockItem);
+    
+    // Return the address of the inode within the block.
+    return (struct inode *)(blockItem->addr + (inodeNum - (blockNum - 1) * INODESPERBLOCK) * INODESIZE);
+}
+
+/**
+ * This function calculates the block number that contains the specified inode 
+ * by dividing the inode number by the number of inodes per block (INODESPERBLOCK) 
+ * and adding 1. It then calls the getBlock() function to retrieve a pointer to 
+ * the data block that contains the specified inode. The retrieved pointer is then 
+ * returned as the output of the function.
+ * 
+ * Inputs:
+ *  inodeNumber: an integer representing the inode number for which we want 
+ *  to retrieve the block.
+ * 
+ * Outputs: 
+ *  A pointer to the block of data that contains the specified inode.
+ * 
+ */
+void *
+getInodeBlockNum(int inodeNumber) 
+{
+    // Calculate and return block number.
+    int blockNumber = (inodeNumber / INODESPERBLOCK) + 1;
+    return getBlock(blockNumber, METADATA_POOL);
+}
+
+/**
+ * This function works out where the block number of the nth block of a file is 
+ * kept. The first NUM_DIRECT blocks are in the inode itself. The next NUM_SINGLE 
+ * are in the indirect block, whose last two slots hold a double and a triple 
+ * indirect block for the blocks after those.
+ * 
+ * Inputs:
+ *  n: the index of the block within the file.
+ *  path: an array of MAP_LEVELS entries, set to the slot to follow in the indirect 
+ *  block and in each map block below it.
+ * 
+ * Outputs: 
+ *  The number of map blocks to go through, 0 for a direct block, or -1 if the file 
+ *  cannot have an nth block.
+ * 
+ */
+int
+getBlockPath(int n, int *path)
+{
+    if (n < 0) {
+        return -1;
+    }
+    if (n < NUM_DIRECT) {
+        return 0;
+    }
+    n -= NUM_DIRECT;
+    if (n < NUM_SINGLE) {
+        path[0] = n;
+        return 1;
+    }
+    n -= NUM_SINGLE;
+    if (n < MAP_SLOTS * MAP_SLOTS) {
+        path[0] = DOUBLE_SLOT;
+        path[1] = n / MAP_SLOTS;
+        path[2] = n % MAP_SLOTS;
+        return 3;
+    }
+    n -= MAP_SLOTS * MAP_SLOTS;
+    if (n < MAP_SLOTS * MAP_SLOTS * MAP_SLOTS) {
+        path[0] = TRIPLE_SLOT;
+        path[1] = n / (MAP_SLOTS * MAP_SLOTS);
+        path[2] = (n / MAP_SLOTS) % MAP_SLOTS;
+        path[3] = n % MAP_SLOTS;
+        return 4;
+    }
+    return -1;
+}
+
+/**
+ * This function takes an inode and an index n, and returns the block number of the 
+ * nth block of the file, allocating the block if necessary and if the 
+ * allocateIfNeeded parameter is true. Blocks past the direct ones are found through 
+ * the map blocks given by getBlockPath, and any map blocks missing on the way to a 
+ * newly allocated block are allocated right after it. If a step fails, the blocks 
+ * allocated on the way are unlinked and freed again.
+ * 
+ * Inputs:
+ *  inode: a pointer to a struct inode representing the file
+ *  inodeNum: the inode number of the file, used to place a newly allocated block
+ *  n: an integer representing the index of the block to retrieve
+ *  allocateIfNeeded: a boolean indicating whether to allocate a new block if necessary
+ * 
+ * Outputs: 
+ *  An integer representing the block number of the nth block of the file.
+ *  Returns 0 if the given index is invalid, if the block could not be allocated, 
+ *  or if a map block could not be cached.
+ * 
+ */
+int
+getNthBlock(struct inode *inode, int inodeNum, int n, bool allocateIfNeeded) 
+{
+    bool isOver = false;
+    int path[MAP_LEVELS + 1];
+    int depth = getBlockPath(n, path);
+    if (depth < 0) {
+        return 0;
+    }
+    if (n*BLOCKSIZE >= inode->size) 
+    {
+        isOver = true;
+    }
+    if (isOver && !allocateIfNeeded) {
+        return 0;
+    }
+    if (depth == 0) {
+        if (isOver) {
+            inode->direct[n] = getNearbyFreeBlockNum(inode, inodeNum, n);
+        }
+        // if getNearbyFreeBlockNum returned 0, return 0
+        return inode->direct[n];
+    } 
+    
+    // Allocate the new block first, so it follows block n-1 of the file.
+    int newBlockNum = 0;
+    if (isOver) {
+        newBlockNum = getNearbyFreeBlockNum(inode, inodeNum, n);
+        if (newBlockNum == 0) {
+            return 0;
+        }
+    }
+    
+    // Walk down the map blocks, allocating the ones that are missing. Only the 
+    // first new map block is linked from an old one (or from the inode), which 
+    // stays pinned so that it can be unlinked again if a later step fails.
+    int newMaps[MAP_LEVELS + 1];
+    int newMapCount = 0;
+    int linkMapNum = 0;
+    int linkSlot = 0;
+    if (inode->indirect == 0 && isOver) {
+        inode->indirect = allocateMapBlock(inodeNum, newBlockNum + 1);
+        if (inode->indirect != 0) {
+            newMaps[newMapCount++] = inode->indirect;
+        }
+    }
+    int mapNum = inode->indirect;
+    int level;
+    for (level = 0; level < depth - 1 && mapNum != 0; level++) {
+        int *map = pinBlock(mapNum, METADATA_POOL);
+        if (map == NULL) {
+            mapNum = 0;
+            break;
+        }
+        int nextMapNum = map[path[level]];
+        bool keepPin = false;
+        if (nextMapNum == 0 && isOver) {
+            nextMapNum = allocateMapBlock(inodeNum, newBlockNum + 1);
+            if (nextMapNum != 0) {
+                map[path[level]] = nextMapNum;
+                saveBlock(mapNum);
+                if (newMapCount == 0) {
+                    linkMapNum = mapNum;
+                    linkSlot = path[level];
+                    keepPin = true;
+                }
+                newMaps[newMapCount++] = nextMapNum;
+            }
+        }
+        if (!keepPin) {
+            unpinBlock(mapNum);
+        }
+        mapNum = nextMapNum;
+    }
+    int *map = (mapNum != 0) ? getBlock(mapNum, METADATA_POOL) : NULL;
+    
+    // If the walk failed, undo the map blocks allocated on the way, and free the new block.
+    if (map == NULL) {
+        if (linkMapNum != 0) {
+            int *linkMap = getBlock(linkMapNum, METADATA_POOL);
+            linkMap[linkSlot] = 0;
+            saveBlock(linkMapNum);
+            unpinBlock(linkMapNum);
+        } else if (newMapCount > 0) {
+            inode->indirect = 0;
+        }
+        int i;
+        for (i = 0; i < newMapCount; i++) {
+            addFreeBlock(newMaps[i]);
+        }
+        if (isOver) {
+            addFreeBlock(newBlockNum);
+        }
+        return 0;
+    }
+    if (isOver) {
+        map[path[depth - 1]] = newBlockNum;
+        saveBlock(mapNum);
+    }
+    int blockNum = map[path[depth - 1]];
+    if (linkMapNum != 0) {
+        unpinBlock(linkMapNum);
+    }
+    return blockNum;
+}
+
+/**
+ * This function finds the map blocks that a file starts to use at its nth block, 
+ * that is the indirect block at block NUM_DIRECT and each lower map block at the 
+ * first block it maps, so that walking the blocks of a file in order also visits 
+ * each of its map blocks once.
+ * 
+ * Inputs:
+ *  inode: a pointer to the inode of the file.
+ *  n: the index of a block of the file.
+ *  mapBlocks: an array of MAP_LEVELS + 1 entries, set to the map blocks found.
+ * 
+ * Outputs: 
+ *  The number of map blocks found, or 0 if a map block cannot be cached.
+ * 
+ */
+int
+getFirstMapBlocks(struct inode *inode, int n, int *mapBlocks)
+{
+    int path[MAP_LEVELS + 1];
+    int depth = getBlockPath(n, path);
+    if (depth <= 0 || inode->indirect == 0) {
+        return 0;
+    }
+    int count = 0;
+    if (n == NUM_DIRECT) {
+        mapBlocks[count++] = inode->indirect;
+    }
+    int mapNum = inode->indirect;
+    int level;
+    for (level = 0; level < depth - 1 && mapNum != 0; level++) {
+        int *map = getBlock(mapNum, METADATA_POOL);
+        if (map == NULL) {
+            TRACE_ALLOC(1, "cannot cache map block %d\n", mapNum);
+            return 0;
+        }
+        mapNum = map[path[level]];
+        // the map block below starts here if every slot after this level is 0
+        int k;
+        bool isFirst = true;
+        for (k = level + 1; k < depth; k++) {
+            if (path[k] != 0) {
+                isFirst = false;
+            }
+        }
+        if (isFirst && mapNum != 0) {
+            mapBlocks[count++] = mapNum;
+        }
+    }
+    return count;
+}
+
+/**
+ * This function hashes the first component of a path, up to the first '/' and at 
+ * most DIRNAMELEN characters, which is as much of it as isEqual compares.
+ * 
+ * Inputs:
+ *  name: the path whose first component is hashed.
+ * 
+ * Outputs: 
+ *  The hash of the component.
+ * 
+ */
+unsigned int
+hashComponent(char *name)
+{
+    unsigned int hash = 2166136261u;
+    int i;
+    for (i = 0; i < DIRNAMELEN && name[i] != '/' && name[i] != '\0'; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * This function hashes a directory and the first component of a path into a slot 
+ * of the name cache.
+ * 
+ * Inputs:
+ *  parentInodeNum: the inode number of the directory.
+ *  name: the path whose first component is hashed.
+ * 
+ * Outputs: 
+ *  The index of the name cache slot for the name.
+ * 
+ */
+int
+hashName(int parentInodeNum, char *name)
+{
+    return (hashComponent(name) ^ (unsigned int)parentInodeNum * 2654435761u) % DCACHE_SLOTS;
+}
+
+/**
+ * This function looks the first component of a path up in the name cache.
+ * 
+ * Inputs:
+ *  parentInodeNum: the inode number of the directory to look the name up in.
+ *  name: the path whose first component is looked up.
+ * 
+ * Outputs: 
+ *  The cache entry for the name, whose inodeNum is 0 if the directory is known not 
+ *  to have the name, or NULL if the name is not cached.
+ * 
+ */
+dcacheEntry *
+lookupDcache(int parentInodeNum, char *name)
+{
+    dcacheEntry *entry = &dcache[hashName(parentInodeNum, name)];
+    if (entry->parentInodeNum == parentInodeNum && isEqual(name, entry->name)) {
+        dcacheHits++;
+        return entry;
+    }
+    dcacheMisses++;
+    return NULL;
+}
+
+/**
+ * This function caches what a directory maps the first component of a path to, 
+ * replacing whatever name was cached in its slot.
+ * 
+ * Inputs:
+ *  parentInodeNum: the inode number of the directory.
+ *  name: the path whose first component is cached.
+ *  inodeNum: the inode number the name refers to, or 0 if the directory does not 
+ *  have the name.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+addDcacheEntry(int parentInodeNum, char *name, int inodeNum)
+{
+    dcacheEntry *entry = &dcache[hashName(parentInodeNum, name)];
+    entry->parentInodeNum = parentInodeNum;
+    entry->inodeNum = inodeNum;
+    memset(entry->name, '\0', DIRNAMELEN);
+    int i;
+    for (i = 0; i < DIRNAMELEN && name[i] != '/' && name[i] != '\0'; i++) {
+        entry->name[i] = name[i];
+    }
+}
+
+/**
+ * This function drops a name from the name cache, if it is cached. Every request 
+ * that adds or removes a name in a directory calls it for that name.
+ * 
+ * Inputs:
+ *  parentInodeNum: the inode number of the directory.
+ *  name: the path whose first component is dropped.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+invalidateDcacheEntry(int parentInodeNum, char *name)
+{
+    dcacheEntry *entry = &dcache[hashName(parentInodeNum, name)];
+    if (entry->parentInodeNum == parentInodeNum && isEqual(name, entry->name)) {
+        entry->parentInodeNum = 0;
+    }
+    changeGeneration(parentInodeNum);
+}
+
+/**
+ * This function drops every name cached from a directory that is being removed, or 
+ * that refers to it, so nothing stale is found if its inode is reused.
+ * 
+ * Inputs:
+ *  dirInodeNum: the inode number of the directory.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+invalidateDcacheDirectory(int dirInodeNum)
+{
+    int i;
+    for (i = 0; i < DCACHE_SLOTS; i++) {
+        if (dcache[i].parentInodeNum == dirInodeNum || dcache[i].inodeNum == dirInodeNum) {
+            dcache[i].parentInodeNum = 0;
+        }
+    }
+    changeGeneration(dirInodeNum);
+}
+
+/**
+ * This function sets up the generation of every inode. Each inode starts with its 
+ * own number as its generation, so that no two inodes ever share a generation, and 
+ * as unchanged for long enough to be granted a full lease.
+ * 
+ * Inputs:
+ *  numInodes: the number of inodes in the file system.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+initGenerations(int numInodes)
+{
+    inodeGenerations = malloc((numInodes + 1) * sizeof(int));
+    inodeChangedAt = malloc((numInodes + 1) * sizeof(int));
+    if (inodeGenerations == NULL || inodeChangedAt == NULL) {
+        TRACE_DIR(1, "error allocating the inode generations\n");
+        Exit(1);
+    }
+    int i;
+    for (i = 0; i <= numInodes; i++) {
+        inodeGenerations[i] = i;
+        inodeChangedAt[i] = -LEASE_MAX_USES;
+    }
+    numGenerations = numInodes + 1;
+    generationCount = numInodes;
+}
+
+/**
+ * This function gives an inode a new generation, newer than every other, when the 
+ * inode or the names in it change, so that leases granted on it are refused.
+ * 
+ * Inputs:
+ *  inodeNum: the inode number of the inode that changed.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+changeGeneration(int inodeNum)
+{
+    if (inodeNum <= 0 || inodeNum >= numGenerations) {
+        return;
+    }
+    inodeGenerations[inodeNum] = ++generationCount;
+    inodeChangedAt[inodeNum] = requestCount;
+}
+
+/**
+ * This function notes an inode that the current lookup went through, keeping the 
+ * newest generation met so far and when it changed.
+ * 
+ * Inputs:
+ *  inodeNum: the inode number of a directory, link or file of the path.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+noteLookupInode(int inodeNum)
+{
+    if (inodeNum <= 0 || inodeNum >= numGenerations) {
+        return;
+    }
+    if (inodeGenerations[inodeNum] > lookupGeneration) {
+        lookupGeneration = inodeGenerations[inodeNum];
+        lookupChangedAt = inodeChangedAt[inodeNum];
+    }
+}
+
+/**
+ * This function returns the current generation of an inode.
+ * 
+ * Inputs:
+ *  inodeNum: the inode number of the inode.
+ * 
+ * Outputs:
+ *  Returns the generation of the inode, or 0 if there is no such inode.
+ * 
+ */
+int
+getGeneration(int inodeNum)
+{
+    if (inodeNum <= 0 || inodeNum >= numGenerations) {
+        return 0;
+    }
+    return inodeGenerations[inodeNum];
+}
+
+/**
+ * This function takes a path and the inode number for the starting directory, 
+ * and returns the inode number for the file or directory represented by the path.
+ * 
+ * Inputs:
+ *  path: the file path to get the inode number for.
+ *  inodeStartNumber: the inode to start looking for the next part of the file path in.
+ * 
+ * Outputs: 
+ *  The inode number of the path, or 0 if it's an invalid path.
+ * 
+ */
+int
+getPathInodeNumber(char *path, int inodeStartNumber)
+{
+    
+    // Get the inode number for the first file in path 
+    int nextInodeNumber = 0;
+
+    // Get inode corresponding to inodeStartNumber
+    struct inode *inode = getInode(inodeStartNumber);
+    if (inode == NULL) {
+        return 0;
+    }
+    noteLookupInode(inodeStartNumber);
+    if (inode->type == INODE_DIRECTORY) {
+        // look the name up in the name cache first, and otherwise go get the 
+        // directory entry in this directory that has that name and cache it
+        dcacheEntry *entry = lookupDcache(inodeStartNumber, path);
+        if (entry != NULL) {
+            nextInodeNumber = entry->inodeNum;
+        } else {
+            int blockNum;
+            struct dir_entry *dir_entry = getDirectoryEntry(path, inodeStartNumber, &blockNum, false);
+            if (dir_entry != NULL) {
+                nextInodeNumber = dir_entry->inum;
+                unpinBlock(blockNum);
+            }
+            if (dir_entry != NULL || !dirEntryUncached) {
+                addDcacheEntry(inodeStartNumber, path, nextInodeNumber);
+            }
+        }
+    } else if (inode->type == INODE_REGULAR) {
+        return 0;
+    } else if (inode->type == INODE_SYMLINK) {
+        return 0;
+    }
+    char *nextPath = path;
+    if (nextInodeNumber == 0) {
+        // Return error
+        return 0;
+    }
+    while (nextPath[0] != '/') {
+        // base case
+        if (nextPath[0] == '\0') {
+            inode = getInode(nextInodeNumber);
+            if (inode == NULL) {
+                return 0;
+            }
+            //TracePrintf(1, "are we a symlink?\n");
+            if (inode->type != INODE_SYMLINK) {
+                return nextInodeNumber;
+            }
+            else {
+                nextPath = path;
+                break;
+            }
+        }
+        nextPath += sizeof (char);
+    }
+    while (nextPath[0] == '/') {
+        nextPath += sizeof (char);
+    }
+    if (nextPath[0] == '\0') {
+        return nextInodeNumber;
+    }
+    inode = getInode(nextInodeNumber);
+    if (inode == NULL) {
+        return 0;
+    }
+    if (inode->type == INODE_SYMLINK) {
+        numSymLinks++;
+        if (numSymLinks > MAXSYMLINKS) {
+            return 0;
+        }
+        // Copy the link target out of its block before resolving it, so that no 
+        // block stays pinned for each link of a chain
+        char target[MAXPATHNAMELEN];
+        int targetLen = (inode->size < MAXPATHNAMELEN) ? inode->size : MAXPATHNAMELEN - 1;
+        char *dataBlock = (char *)getBlock(inode->direct[0], METADATA_POOL);
+        if (dataBlock == NULL) {
+            return 0;
+        }
+        memcpy(target, dataBlock, targetLen);
+        target[targetLen] = '\0';
+        char *targetPath = target;
+        if (targetPath[0] == '/') {
+            targetPath += sizeof(char);
+            inodeStartNumber = ROOTINODE;
+        }
+        nextInodeNumber = getPathInodeNumber(targetPath, inodeStartNumber);
+        while (nextPath[0] != '/') {
+            if (nextPath[0] == '\0') {
+                return nextInodeNumber;
+            }
+            nextPath += sizeof (char);
+        }
+        while (nextPath[0] == '/')
+            nextPath += sizeof(char);        
+    }
+    return getPathInodeNumber(nextPath, nextInodeNumber);
+}
+
+/**
+ * This function marks the given inode number as free by modifying its type to 
+ * INODE_FREE, and marks it free in the free inode bitmap.
+ * 
+ * Inputs:
+ *  inodeNum: an integer representing the inode number to be marked as free.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+freeUpInode(int inodeNum) 
+{
+    // Get address of this inode. 
+    struct inode *inode = getInode(inodeNum);
+    if (inode == NULL) {
+        return;
+    }
+    
+    // Modify the type of inode to free.
+    inode->type = INODE_FREE;
+
+    addFreeInode(inodeNum);
+
+    saveInode(inodeNum);
+}
+
+/**
+ * This function finds the lowest set bit in a bitmap, a 64-bit word at a time, 
+ * starting from the word given by the hint, and clears it. The hint is moved up 
+ * to the word the bit was found in, since every word below it has no set bit.
+ * 
+ * Inputs:
+ *  map: a pointer to the bitmap.
+ *  words: the number of 64-bit words in the bitmap.
+ *  hint: a pointer to the index of the first word that may have a set bit.
+ * 
+ * Outputs: 
+ *  The index of the bit that was cleared, or -1 if no bit was set.
+ * 
+ */
+int
+takeFirstSetBit(uint64_t *map, int words, int *hint)
+{
+    int w;
+    for (w = *hint; w < words; w++) {
+        if (map[w] != 0) {
+            int bit = __builtin_ctzll(map[w]);
+            map[w] &= map[w] - 1;
+            *hint = w;
+            return w * 64 + bit;
+        }
+    }
+    *hint = words;
+    return -1;
+}
+
+/**
+ * This function sets a bit in a bitmap and moves the hint down to its word.
+ * 
+ * Inputs:
+ *  map: a pointer to the bitmap.
+ *  index: the index of the bit to set.
+ *  hint: a pointer to the index of the first word that may have a set bit.
+ * 
+ * Outputs: 
+ *  Returns true if the bit was clear before. Otherwise, returns false.
+ * 
+ */
+bool
+setBit(uint64_t *map, int index, int *hint)
+{
+    uint64_t mask = (uint64_t)1 << (index % 64);
+    if (map[index / 64] & mask) {
+        return false;
+    }
+    map[index / 64] |= mask;
+    if (index / 64 < *hint) {
+        *hint = index / 64;
+    }
+    return true;
+}
+
+/**
+ * This function gets the number of the next free inode in the file system, and 
+ * updates the inode structure for that inode to indicate it has been reused.
+ * 
+ * Inputs: None.  
+ * 
+ * Outputs: 
+ *  The number of the next free inode in the file system, or 0 if there are 
+ *  no free inodes left or its inode block cannot be cached.
+ * 
+ */
+int 
+getNextFreeInodeNum(void) 
+{
+    // Take the lowest free inode off the bitmap, if there is one
+    int inodeNum = takeFirstSetBit(freeInodeMap, freeInodeMapWords, &freeInodeHint);
+    if (inodeNum == -1) {
+        return 0;
+    }
+    markFreeMapDirty(&freeInodeMap[inodeNum / 64]);
+    freeInodeCount--;
+    // Get the inode structure for the inode number, giving the inode back if 
+    // its inode block cannot be cached
+    struct inode *inode = getInode(inodeNum);
+    if (inode == NULL) {
+        addFreeInode(inodeNum);
+        return 0;
+    }
+    // Increment the reuse counter to indicate that the inode has been reused
+    inode->reuse++;
+    // Save the inode structure to disk
+    saveInode(inodeNum);
+    // Return the inode number of the reused inode
+    return inodeNum;
+}
+
+/**
+ * This function marks an inode as free in the free inode bitmap.
+ * 
+ * Inputs:
+ *  inodeNum: an integer representing the inode number of the inode 
+ *  that is being freed.
+ * 
+ * Outputs: None.  
+ */
+void 
+addFreeInode(int inodeNum) 
+{
+    // Only count the inode if it was not free already
+    if (setBit(freeInodeMap, inodeNum, &freeInodeHint)) {
+        markFreeMapDirty(&freeInodeMap[inodeNum / 64]);
+        freeInodeCount++;
+    }
+}
+
+/**
+ * This function returns the number of the next free block and marks it as 
+ * in use in the free block bitmap.
+ * 
+ * Inputs: None.  
+ * 
+ * Outputs: 
+ *  Integer representing the number of the next free block, or 0 if there are 
+ *  no free blocks left.
+ * 
+ */
+int 
+getNextFreeBlockNum(void) 
+{
+    // Take the lowest free block off the bitmap, if there is one
+    int blockNum = takeFirstSetBit(freeBlockMap, freeBlockMapWords, &freeBlockHint);
+    if (blockNum == -1) { 
+        // Return 0 to indicate that there are no free blocks.
+        return 0; 
+    }
+    markFreeMapDirty(&freeBlockMap[blockNum / 64]);
+    freeBlockCount--;
+    return blockNum; 
+}
+
+/**
+ * This function marks a block as free in the free block bitmap.
+ * 
+ * Inputs:
+ *  blockNum: an integer representing the block number to be freed.
+ * 
+ * Outputs: None.  
+ * 
+ */
+void
+addFreeBlock(int blockNum) 
+{
+    // Only count the block if it was not free already
+    if (setBit(freeBlockMap, blockNum, &freeBlockHint)) {
+        markFreeMapDirty(&freeBlockMap[blockNum / 64]);
+        freeBlockCount++;
+    }
+}
+
+/**
+ * This function flags the on-disk block of the free bitmaps that holds the given 
+ * bitmap word as changed, so that the next sync writes it.
+ * 
+ * Inputs:
+ *  word: a pointer to a word of the free inode or block bitmap.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+markFreeMapDirty(uint64_t *word)
+{
+    freeMapDirty[((char *)word - (char *)freeMaps) / BLOCKSIZE] = true;
+}
+
+/**
+ * This function writes the blocks of the free bitmaps that changed since they were 
+ * last written back to their place on disk.
+ * 
+ * Inputs: None.
+ * 
+ * Outputs: 
+ *  The number of blocks that could not be written; they stay flagged as changed.
+ * 
+ */
+int
+writeFreeMaps(void)
+{
+    int failedCount = 0;
+    int i;
+    for (i = 0; i < freeMapBlocks; i++) {
+        if (!freeMapDirty[i]) {
+            continue;
+        }
+        if (WriteSector(freeMapStart + i, (char *)freeMaps + i * BLOCKSIZE) != 0) {
+            TRACE_ALLOC(1, "error writing free bitmap block %d\n", freeMapStart + i);
+            failedCount++;
+        } else {
+            freeMapDirty[i] = false;
+        }
+    }
+    return failedCount;
+}
+
+/**
+ * This function sets the clean-unmount flag in the file system header and writes 
+ * the header block to disk right away. The flag is cleared as soon as the server 
+ * starts and set again only by a shutdown that wrote everything back, so a disk 
+ * whose flag is set has up to date free bitmaps.
+ * 
+ * Inputs:
+ *  clean: 1 to mark the file system as cleanly unmounted, or 0 to mark it in use.
+ * 
+ * Outputs: 
+ *  Upon success, returns 0. Otherwise, returns ERROR if the header block cannot be 
+ *  cached or written, and the flag on disk is left as it was.
+ * 
+ */
+int
+writeFsHeader(int clean)
+{
+    cacheItem *headerItem = getBlockItem(1, METADATA_POOL);
+    if (headerItem == NULL) {
+        TRACE_ALLOC(1, "cannot cache the file system header\n");
+        return ERROR;
+    }
+    struct yfs_header *header = (struct yfs_header *)headerItem->addr;
+    int wasClean = header->clean;
+    header->clean = clean;
+    if (WriteSector(1, headerItem->addr) != 0) {
+        // Keep the flag as it is on disk, so a later write back of the block 
+        // does not set it.
+        TRACE_ALLOC(1, "error writing the file system header\n");
+        header->clean = wasClean;
+        return ERROR;
+    }
+    // The whole block went out, including any inodes changed in it.
+    if (headerItem->dirty) {
+        markClean(headerItem);
+    }
+    return 0;
+}
+
+/**
+ * This function takes a run of consecutive free blocks off the free block bitmap.
+ * 
+ * Inputs:
+ *  count: the number of blocks in the run.
+ * 
+ * Outputs: 
+ *  The first block of the run, or 0 if there is no such run of free blocks.
+ * 
+ */
+int
+takeFreeBlockRun(int count)
+{
+    int first = 0;
+    int length = 0;
+    int i;
+    for (i = 0; i < freeBlockMapWords * 64 && length < count; i++) {
+        if (freeBlockMap[i / 64] & ((uint64_t)1 << (i % 64))) {
+            if (length++ == 0) {
+                first = i;
+            }
+        } else {
+            length = 0;
+        }
+    }
+    if (length < count) {
+        return 0;
+    }
+    for (i = first; i < first + count; i++) {
+        takeFreeBlock(i);
+    }
+    return first;
+}
+
+/**
+ * This function checks whether a block is free in the free block bitmap.
+ * 
+ * Inputs:
+ *  blockNum: the block number to check.
+ * 
+ * Outputs: 
+ *  True if the block is free, false otherwise.
+ * 
+ */
+bool
+isFreeBlock(int blockNum)
+{
+    return (freeBlockMap[blockNum / 64] & ((uint64_t)1 << (blockNum % 64))) != 0;
+}
+
+/**
+ * This function marks a given free block as in use in the free block bitmap.
+ * 
+ * Inputs:
+ *  blockNum: the number of a free block.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+takeFreeBlock(int blockNum)
+{
+    freeBlockMap[blockNum / 64] &= ~((uint64_t)1 << (blockNum % 64));
+    markFreeMapDirty(&freeBlockMap[blockNum / 64]);
+    freeBlockCount--;
+}
+
+/**
+ * This function checks whether a block lies in the window reserved for the next 
+ * blocks of a file other than the given one.
+ * 
+ * Inputs:
+ *  blockNum: the block number to check.
+ *  inodeNum: the inode number of the file that wants the block.
+ * 
+ * Outputs: 
+ *  True if another file has the block reserved, false otherwise.
+ * 
+ */
+bool
+isReservedByOther(int blockNum, int inodeNum)
+{
+    int i;
+    for (i = 0; i < RESERVE_SLOTS; i++) {
+        blockReservation *reservation = &blockReservations[i];
+        if (reservation->inodeNum != 0 && reservation->inodeNum != inodeNum &&
+            blockNum >= reservation->start && blockNum < reservation->end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * This function reserves the window of reserveWindow blocks starting at a given 
+ * block for the next blocks of a file, cut short where the window of another file 
+ * begins. The reservation is only advisory: the blocks stay free in the bitmap, 
+ * and other files just avoid them while they can.
+ * 
+ * Inputs:
+ *  inodeNum: the inode number of the file.
+ *  start: the first block of the window.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+reserveBlocks(int inodeNum, int start)
+{
+    blockReservation *reservation = &blockReservations[inodeNum % RESERVE_SLOTS];
+    int end = start + reserveWindow;
+    int i;
+    for (i = 0; i < RESERVE_SLOTS; i++) {
+        blockReservation *other = &blockReservations[i];
+        if (other != reservation && other->inodeNum != 0 &&
+            other->start >= start && other->start < end) {
+            end = other->start;
+        }
+    }
+    reservation->inodeNum = inodeNum;
+    reservation->start = start;
+    reservation->end = end;
+}
+
+/**
+ * This function drops the reservation of a file, if it still has one.
  * 
- * Inputs: None.  
+ * Inputs:
+ *  inodeNum: the inode number of the file.
  * 
- * Outputs: 
- *  Integer representing the number of the next free block.
+ * Outputs: None.
  * 
  */
-int 
-getNextFreeBlockNum(void) 
+void
+releaseReservation(int inodeNum)
 {
-    // If there are no free blocks left:
-    if (firstFreeBlock == NULL) { 
-        // Return 0 to indicate that there are no free blocks.
-        return 0; 
+    blockReservation *reservation = &blockReservations[inodeNum % RESERVE_SLOTS];
+    if (reservation->inodeNum == inodeNum) {
+        reservation->inodeNum = 0;
     }
-    // Get the block number of the first free block.
-    int blockNum = firstFreeBlock->blockNumber; 
-    // Update the free list by removing the first free block.
-    firstFreeBlock = firstFreeBlock->next;
-    // Return the block number of the next free block.
-    return blockNum; 
 }
 
 /**
- * This function adds a new free block to the head of the free block list.
+ * This function searches the free block bitmap, starting at a goal block and 
+ * wrapping around the end of the disk, for the first run of reserveWindow free 
+ * blocks that no other file has reserved, so that a file starting there can grow 
+ * contiguously.
  * 
  * Inputs:
- *  blockNum: an integer representing the block number to be added to the list.
+ *  goal: the block to start searching at.
+ *  inodeNum: the inode number of the file that wants the blocks.
  * 
- * Outputs: None.  
+ * Outputs: 
+ *  The first block of the run, or if there is no such run, the first free block 
+ *  not reserved by another file. Returns 0 if there is no such block either.
  * 
  */
-void
-addFreeBlockToList(int blockNum) 
+int
+findFreeWindow(int goal, int inodeNum)
 {
-    // Allocate memory for the new free block and initialize its values.
-    freeBlock *newHead = malloc(sizeof(freeBlock));
-    newHead->blockNumber = blockNum;
-    newHead->next = firstFreeBlock;
+    int numBlocks = freeBlockMapWords * 64;
+    int firstFree = 0;
+    int first = 0;
+    int length = 0;
+    int i;
+    for (i = 0; i < numBlocks; i++) {
+        int blockNum = (goal + i) % numBlocks;
+        // a run cannot wrap around the end of the disk
+        if (blockNum == 0) {
+            length = 0;
+        }
+        if (!isFreeBlock(blockNum) || isReservedByOther(blockNum, inodeNum)) {
+            length = 0;
+            continue;
+        }
+        if (firstFree == 0) {
+            firstFree = blockNum;
+        }
+        if (length++ == 0) {
+            first = blockNum;
+        }
+        if (length >= reserveWindow) {
+            return first;
+        }
+    }
+    return firstFree;
+}
 
-    // Update the head of the free block list to point to the new block.
-    firstFreeBlock = newHead;
+/**
+ * This function allocates the nth block of a file close to where the file already 
+ * is: right after its block n-1 when that block is free, and otherwise at the start 
+ * of a free window found from there, or for the first block of a file, from the 
+ * block holding its inode. The blocks after the one allocated are then reserved 
+ * for the file, so that files written at the same time do not interleave.
+ * 
+ * Inputs:
+ *  inode: a pointer to the inode of the file.
+ *  inodeNum: the inode number of the file.
+ *  n: the index within the file of the block being allocated.
+ * 
+ * Outputs: 
+ *  The allocated block number, or 0 if there are no free blocks.
+ * 
+ */
+int
+getNearbyFreeBlockNum(struct inode *inode, int inodeNum, int n)
+{
+    // Aim right after the previous block of the file, or at its inode block.
+    int prevBlockNum = 0;
+    int goal = (inodeNum / INODESPERBLOCK) + 1;
+    if (n > 0) {
+        prevBlockNum = getNthBlock(inode, inodeNum, n - 1, false);
+        if (prevBlockNum != 0) {
+            goal = prevBlockNum + 1;
+        }
+    }
+    
+    int blockNum;
+    if (goal < freeBlockMapWords * 64 && isFreeBlock(goal) && 
+        !isReservedByOther(goal, inodeNum)) {
+        blockNum = goal;
+    } else {
+        blockNum = findFreeWindow(goal, inodeNum);
+    }
+    if (blockNum != 0) {
+        takeFreeBlock(blockNum);
+    } else {
+        // Every free block is reserved by other files, so take one anyway.
+        blockNum = getNextFreeBlockNum();
+        if (blockNum == 0) {
+            return 0;
+        }
+    }
+    reserveBlocks(inodeNum, blockNum + 1);
+    
+    // Count the block toward the fragmentation metric.
+    allocatedBlockCount++;
+    if (n == 0) {
+        allocatedFileCount++;
+    }
+    if (prevBlockNum == 0 || blockNum != prevBlockNum + 1) {
+        allocatedExtentCount++;
+    }
+    return blockNum;
+}
 
-    // Increment the count of free blocks in the system.
-    freeBlockCount++;
+/**
+ * This function allocates a map block for a file as close as possible to a goal 
+ * block, and gives it a zeroed frame in the cache to be written out.
+ * 
+ * Inputs:
+ *  inodeNum: the inode number of the file.
+ *  goal: the block the map block should preferably be.
+ * 
+ * Outputs: 
+ *  The allocated block number, or 0 if there are no free blocks or the block cannot 
+ *  be cached.
+ * 
+ */
+int
+allocateMapBlock(int inodeNum, int goal)
+{
+    int blockNum = 0;
+    if (goal < freeBlockMapWords * 64 && isFreeBlock(goal)) {
+        blockNum = goal;
+        takeFreeBlock(blockNum);
+    } else {
+        blockNum = getNextFreeBlockNum();
+    }
+    if (blockNum == 0) {
+        return 0;
+    }
+    if (getNewBlock(blockNum, METADATA_POOL) == NULL) {
+        addFreeBlock(blockNum);
+        return 0;
+    }
+    reserveBlocks(inodeNum, blockNum + 1);
+    saveBlock(blockNum);
+    return blockNum;
 }
 
 /**
- * This function builds the lists of free inodes and free blocks by examining the
- * file system blocks and inodes. 
+ * This function builds the bitmaps of free inodes and free blocks. After a clean 
+ * shutdown they are read back from where the header says they are on disk, in a 
+ * few sequential reads. Otherwise they are rebuilt by examining the file system 
+ * blocks and inodes, and given a place on disk if they do not have one yet. In 
+ * both cases the file system is then marked as in use until the next shutdown.
  * 
  * Inputs: None.  
  * 
@@ -706,58 +2060,144 @@ addFreeBlockToList(int blockNum)
  * 
  */
 void
-buildFreeInodeAndBlockLists(void) 
+buildFreeInodeAndBlockMaps(void) 
 {
     
     int blockNum = 1;
-    void *block = getBlock(blockNum);
+    void *block = getBlock(blockNum, METADATA_POOL);
     
-    struct fs_header header = *((struct fs_header*) block);
+    struct yfs_header header = *((struct yfs_header*) block);
     
-    TracePrintf(1, "num_blocks: %d, num_inodes: %d\n", header.num_blocks,
+    TRACE_ALLOC(1, "num_blocks: %d, num_inodes: %d\n", header.num_blocks,
         header.num_inodes);
     
+    // allocate both bitmaps in one buffer of whole blocks, with every bit 
+    // clear, i.e. in use
+    freeInodeMapWords = (header.num_inodes + 1 + 63) / 64;
+    freeBlockMapWords = (header.num_blocks + 63) / 64;
+    freeMapBlocks = ((freeInodeMapWords + freeBlockMapWords) * (int)sizeof(uint64_t) 
+        + BLOCKSIZE - 1) / BLOCKSIZE;
+    freeMaps = calloc(freeMapBlocks, BLOCKSIZE);
+    freeMapDirty = calloc(freeMapBlocks, sizeof(bool));
+    if (freeMaps == NULL || freeMapDirty == NULL) {
+        TRACE_ALLOC(1, "error allocating the free inode and block bitmaps\n");
+        Exit(1);
+    }
+    freeInodeMap = freeMaps;
+    freeBlockMap = freeMaps + freeInodeMapWords;
+    initGenerations(header.num_inodes);
+    
+    // the bitmaps already have a place on disk if the header describes them
+    bool hasMaps = (header.magic == YFS_MAGIC && header.map_blocks == freeMapBlocks);
+    if (hasMaps) {
+        freeMapStart = header.map_start;
+    }
+    
+    // after a clean shutdown just read the bitmaps back and count their bits
+    if (hasMaps && header.clean) {
+        int i;
+        for (i = 0; i < freeMapBlocks; i++) {
+            ReadSector(freeMapStart + i, (char *)freeMaps + i * BLOCKSIZE);
+        }
+        for (i = 0; i < freeInodeMapWords; i++) {
+            freeInodeCount += __builtin_popcountll(freeInodeMap[i]);
+        }
+        for (i = 0; i < freeBlockMapWords; i++) {
+            freeBlockCount += __builtin_popcountll(freeBlockMap[i]);
+        }
+        TRACE_ALLOC(1, "loaded free bitmaps with %d free inodes and %d free blocks\n", 
+            freeInodeCount, freeBlockCount);
+        writeFsHeader(0);
+        return;
+    }
+    
     // create array indexed by block number
     bool takenBlocks[header.num_blocks];
     // initialize each item to false
     memset(takenBlocks, false, header.num_blocks * sizeof(bool));
-    // sector 0 is taken
-    takenBlocks[0] = true;
+    // sector 0, the header and the inode blocks are taken
+    int numInodeBlocks = ((header.num_inodes + 1) * INODESIZE + BLOCKSIZE - 1) / BLOCKSIZE;
+    int i;
+    for (i = 0; i <= numInodeBlocks; i++) {
+        takenBlocks[i] = true;
+    }
+    // and so are the blocks of the bitmaps themselves
+    if (hasMaps) {
+        for (i = freeMapStart; i < freeMapStart + freeMapBlocks; i++) {
+            takenBlocks[i] = true;
+        }
+    }
     
     // for each block that contains inodes
     int inodeNum = ROOTINODE;
-    while (inodeNum < header.num_inodes) {
-        // for each inode, if it's free, add it to the free list
-        for (; inodeNum < INODESPERBLOCK * blockNum; inodeNum++) {
+    while (inodeNum <= header.num_inodes) {
+        // for each inode, if it's free, mark it free in the bitmap
+        for (; inodeNum < INODESPERBLOCK * blockNum && inodeNum <= header.num_inodes; inodeNum++) {
             struct inode *inode = getInode(inodeNum);
+            if (inode == NULL) {
+                TRACE_ALLOC(1, "cannot cache the block of inode %d\n", inodeNum);
+                continue;
+            }
             if (inode->type == INODE_FREE) {
-                addFreeInodeToList(inodeNum);
+                addFreeInode(inodeNum);
             } else {
                 // keep track of all these blocks as taken
                 int i = 0;
                 int blockNum;
-                while((blockNum = getNthBlock(inode, i++, false)) != 0) {
+                while((blockNum = getNthBlock(inode, inodeNum, i, false)) != 0) {
                     takenBlocks[blockNum] = true;
+                    int mapBlocks[MAP_LEVELS + 1];
+                    int count = getFirstMapBlocks(inode, i, mapBlocks);
+                    while (count > 0) {
+                        takenBlocks[mapBlocks[--count]] = true;
+                    }
+                    i++;
+                }
+                // and so are the blocks of a directory's hash index
+                dirIndexHeader indexHeader;
+                if (inode->type == INODE_DIRECTORY && 
+                    readDirIndexHeader(inode, inodeNum, &indexHeader)) {
+                    for (i = 0; i < indexHeader.slotCount / MAP_SLOTS; i++) {
+                        takenBlocks[indexHeader.start + i] = true;
+                    }
                 }
             }
         }
+        // unpin the finished inode block so the scan can run past the cache size
+        releaseRequestPins();
         blockNum++;
-        block = getBlock(blockNum);
+        block = getBlock(blockNum, METADATA_POOL);
     }
-    TracePrintf(1, "initialized free inode list with %d free inodes\n", 
+    TRACE_ALLOC(1, "initialized free inode bitmap with %d free inodes\n", 
         freeInodeCount);
     
     // for each element in the block array
-    int i;
     for (i = 0; i < header.num_blocks; i++) {
         if (!takenBlocks[i]) {
-            // add block to list
-            addFreeBlockToList(i);
+            // mark the block free
+            addFreeBlock(i);
         }
     }
-    TracePrintf(1, "initialized free block list with %d free blocks\n", 
+    TRACE_ALLOC(1, "initialized free block bitmap with %d free blocks\n", 
         freeBlockCount);
     
+    // give the bitmaps a place on disk and describe it in the header
+    if (!hasMaps) {
+        freeMapStart = takeFreeBlockRun(freeMapBlocks);
+        if (freeMapStart == 0) {
+            TRACE_ALLOC(1, "no room on disk for the free bitmaps\n");
+            return;
+        }
+        struct yfs_header *diskHeader = (struct yfs_header *)getBlock(1, METADATA_POOL);
+        diskHeader->magic = YFS_MAGIC;
+        diskHeader->map_start = freeMapStart;
+        diskHeader->map_blocks = freeMapBlocks;
+    }
+    // every block of the rebuilt bitmaps has to be written
+    for (i = 0; i < freeMapBlocks; i++) {
+        freeMapDirty[i] = true;
+    }
+    writeFsHeader(0);
 }
 
 /**
@@ -775,10 +2215,23 @@ clearFile(struct inode *inode, int inodeNum)
 {
     int i = 0;
     int blockNum;
-    // Iterate over each block in the inode, adding it to the free block list.
-    while ((blockNum = getNthBlock(inode, i++, false)) != 0) {
-        addFreeBlockToList(blockNum);
+    // A directory's hash index is not among its blocks, so free it first.
+    if (inode->type == INODE_DIRECTORY) {
+        freeDirIndex(inode, inodeNum);
+    }
+    // Iterate over each block in the inode, adding it and the map blocks it 
+    // starts to the free block list.
+    while ((blockNum = getNthBlock(inode, inodeNum, i, false)) != 0) {
+        addFreeBlock(blockNum);
+        int mapBlocks[MAP_LEVELS + 1];
+        int count = getFirstMapBlocks(inode, i, mapBlocks);
+        while (count > 0) {
+            addFreeBlock(mapBlocks[--count]);
+        }
+        i++;
     }
+    inode->indirect = 0;
+    releaseReservation(inodeNum);
     // Reset the size of the file to 0 and save the inode.
     inode->size = 0;
     saveInode(inodeNum);
@@ -786,6 +2239,8 @@ clearFile(struct inode *inode, int inodeNum)
 
 /**
  * This function retrieves the directory entry of a file or creates it if it does not exist.
+ * The block holding the returned entry is left pinned, so the caller can use the entry 
+ * directly and must call unpinBlock on *blockNumPtr when it is done with it.
  * 
  * Inputs:
  *  pathname: a string representing the path to the file.
@@ -794,36 +2249,58 @@ clearFile(struct inode *inode, int inodeNum)
  *  createIfNeeded: a boolean indicating whether to create the directory entry if it does not exist.
  * 
  * Outputs: 
- *  An integer representing the offset of the directory entry within its block, or -1 if the 
- *  directory entry does not exist and createIfNeeded is false.
+ *  A pointer to the directory entry within its pinned block, or NULL if the directory 
+ *  entry does not exist and createIfNeeded is false, or if it could not be created or 
+ *  its block could not be cached. The index of the entry within the directory is left 
+ *  in dirEntryIndex.
  * 
  */
-int
+struct dir_entry *
 getDirectoryEntry(char *pathname, int inodeStartNumber, int *blockNumPtr, bool createIfNeeded) 
 {
-    int freeEntryOffset = -1;
+    struct dir_entry *freeEntry = NULL;
     int freeEntryBlockNum = 0;
-    void * currentBlock;
-    struct dir_entry *currentEntry;
+    void * currentBlock = NULL;
+    struct dir_entry *currentEntry = NULL;
+    dirEntryUncached = false;
     struct inode *inode = getInode(inodeStartNumber);
+    if (inode == NULL) {
+        dirEntryUncached = true;
+        return NULL;
+    }
+    
+    // Large directories are searched through their hash index instead.
+    if (inode->size > DIR_INDEX_THRESHOLD &&
+        lookupDirIndex(pathname, inodeStartNumber, blockNumPtr, createIfNeeded, &currentEntry)) {
+        return currentEntry;
+    }
+    
     int i = 0;
-    int blockNum = getNthBlock(inode, i, false);
+    int blockNum = getNthBlock(inode, inodeStartNumber, i, false);
     int currBlockNum = 0;
     int totalSize = sizeof (struct dir_entry);
     bool isFound = false;
+    int freeEntryIndex = 0;
     while (blockNum != 0 && !isFound) {
-        currentBlock = getBlock(blockNum);
+        // Keep the block being scanned pinned; the previous one is released below
+        currentBlock = pinBlock(blockNum, METADATA_POOL);
+        if (currentBlock == NULL) {
+            break;
+        }
         currentEntry = (struct dir_entry *) currentBlock;
         while (totalSize <= inode->size 
                 && ((char *) currentEntry < ((char *) currentBlock + BLOCKSIZE))) 
         {
-            if (freeEntryOffset == -1 && currentEntry->inum == 0) {
+            if (freeEntry == NULL && currentEntry->inum == 0) {
+                // hold an extra pin on the block with the first free entry
+                pinBlock(blockNum, METADATA_POOL);
                 freeEntryBlockNum = blockNum;
-                freeEntryOffset = (int)((char *)currentEntry - (char *)currentBlock);
+                freeEntry = currentEntry;
+                freeEntryIndex = totalSize / sizeof(struct dir_entry) - 1;
             }
             
             //check the currentEntry fileName to see if it matches
-            TracePrintf(1, "current entry->name - %s\n", currentEntry->name);
+            TRACE_DIR(3, "current entry->name - %s\n", currentEntry->name);
             if (isEqual(pathname, currentEntry->name)) {
                 isFound = true;
                 break;
@@ -836,42 +2313,492 @@ getDirectoryEntry(char *pathname, int inodeStartNumber, int *blockNumPtr, bool c
         if (isFound) {
             break;
         }
+        if (currBlockNum != 0) {
+            unpinBlock(currBlockNum);
+        }
         currBlockNum = blockNum;
-        blockNum = getNthBlock(inode, ++i, false);
+        blockNum = getNthBlock(inode, inodeStartNumber, ++i, false);
     }
     *blockNumPtr = blockNum;
 
+    // A block of the directory that could not be cached ends the search with nothing.
+    if (blockNum != 0 && currentBlock == NULL) {
+        dirEntryUncached = true;
+        if (currBlockNum != 0) {
+            unpinBlock(currBlockNum);
+        }
+        if (freeEntry != NULL) {
+            unpinBlock(freeEntryBlockNum);
+        }
+        return NULL;
+    }
+
     if (isFound) {
-        int offset = (int)((char *)currentEntry - (char *)currentBlock);
-        return offset;
+        // only the block holding the entry stays pinned
+        dirEntryIndex = totalSize / sizeof(struct dir_entry) - 1;
+        if (currBlockNum != 0) {
+            unpinBlock(currBlockNum);
+        }
+        if (freeEntry != NULL) {
+            unpinBlock(freeEntryBlockNum);
+        }
+        return currentEntry;
     } 
     if (createIfNeeded) {
-        if (freeEntryBlockNum != 0) {
+        if (freeEntry != NULL) {
+            if (currBlockNum != 0) {
+                unpinBlock(currBlockNum);
+            }
             *blockNumPtr = freeEntryBlockNum;
-            return freeEntryOffset;
+            dirEntryIndex = freeEntryIndex;
+            return freeEntry;
         }
+        dirEntryIndex = inode->size / sizeof(struct dir_entry);
         if (inode->size % BLOCKSIZE == 0) {
             // we're at the bottom edge of the block, so
             // we need to allocate a new block
-            blockNum = getNthBlock(inode, i, true);
-            currentBlock = getBlock(blockNum);
+            if (currBlockNum != 0) {
+                unpinBlock(currBlockNum);
+            }
+            blockNum = getNthBlock(inode, inodeStartNumber, i, true);
+            if (blockNum == 0 || getNewBlock(blockNum, METADATA_POOL) == NULL) {
+                return NULL;
+            }
+            currentBlock = pinBlock(blockNum, METADATA_POOL);
             inode->size += sizeof(struct dir_entry);
             struct dir_entry * newEntry = (struct dir_entry *) currentBlock;
             newEntry->inum = 0;
             saveBlock(blockNum);
             saveInode(inodeStartNumber);
             *blockNumPtr = blockNum;
-            return 0;
+            return newEntry;
         } 
         inode->size += sizeof(struct dir_entry);
-        saveInode(inodeStartNumber);
-        currentEntry->inum = 0;
-        saveBlock(currBlockNum);
-        *blockNumPtr = currBlockNum;
-        int offset = (int)((char *)currentEntry - (char *)currentBlock);
-        return offset;
+        saveInode(inodeStartNumber);
+        currentEntry->inum = 0;
+        saveBlock(currBlockNum);
+        *blockNumPtr = currBlockNum;
+        return currentEntry;
+    }
+    if (currBlockNum != 0) {
+        unpinBlock(currBlockNum);
+    }
+    if (freeEntry != NULL) {
+        unpinBlock(freeEntryBlockNum);
+    }
+    return NULL;
+}
+
+/**
+ * This function reads the header of the hash index of a directory from the unused 
+ * name bytes of its "." entry, the first entry of its first block. Readers of the 
+ * directory as a flat array of dir_entry never look past the '\0' ending the name.
+ * 
+ * Inputs:
+ *  inode: a pointer to the inode of the directory.
+ *  dirInodeNum: the inode number of the directory.
+ *  header: the header to fill in.
+ * 
+ * Outputs: 
+ *  True if the directory has an index, false otherwise, or if its first block 
+ *  cannot be cached.
+ * 
+ */
+bool
+readDirIndexHeader(struct inode *inode, int dirInodeNum, dirIndexHeader *header)
+{
+    int blockNum = getNthBlock(inode, dirInodeNum, 0, false);
+    if (blockNum == 0) {
+        return false;
+    }
+    struct dir_entry *dotEntry = (struct dir_entry *)getBlock(blockNum, METADATA_POOL);
+    if (dotEntry == NULL) {
+        return false;
+    }
+    memcpy(header, dotEntry->name + DIR_INDEX_OFFSET, sizeof(dirIndexHeader));
+    return header->magic == DIR_INDEX_MAGIC;
+}
+
+/**
+ * This function writes the header of the hash index of a directory into the unused 
+ * name bytes of its "." entry.
+ * 
+ * Inputs:
+ *  inode: a pointer to the inode of the directory.
+ *  dirInodeNum: the inode number of the directory.
+ *  header: the header to write.
+ * 
+ * Outputs: 
+ *  True if the header was written, or false if the first block of the directory 
+ *  cannot be cached.
+ * 
+ */
+bool
+writeDirIndexHeader(struct inode *inode, int dirInodeNum, dirIndexHeader *header)
+{
+    int blockNum = getNthBlock(inode, dirInodeNum, 0, false);
+    if (blockNum == 0) {
+        return false;
+    }
+    struct dir_entry *dotEntry = (struct dir_entry *)getBlock(blockNum, METADATA_POOL);
+    if (dotEntry == NULL) {
+        return false;
+    }
+    memcpy(dotEntry->name + DIR_INDEX_OFFSET, header, sizeof(dirIndexHeader));
+    saveBlock(blockNum);
+    return true;
+}
+
+/**
+ * This function finds a slot of the hash index of a directory in its cached block.
+ * 
+ * Inputs:
+ *  header: the header of the index.
+ *  slot: the number of the slot.
+ *  blockNumPtr: set to the number of the block holding the slot.
+ * 
+ * Outputs: 
+ *  A pointer to the slot, valid until the cache is next used, or NULL if its block 
+ *  cannot be cached.
+ * 
+ */
+int *
+getDirIndexSlot(dirIndexHeader *header, int slot, int *blockNumPtr)
+{
+    *blockNumPtr = header->start + slot / MAP_SLOTS;
+    int *slots = (int *)getBlock(*blockNumPtr, METADATA_POOL);
+    if (slots == NULL) {
+        return NULL;
+    }
+    return &slots[slot % MAP_SLOTS];
+}
+
+/**
+ * This function finds an entry of a directory by its index within the directory, 
+ * leaving the block that holds it pinned for the caller.
+ * 
+ * Inputs:
+ *  inode: a pointer to the inode of the directory.
+ *  dirInodeNum: the inode number of the directory.
+ *  entryIndex: the index of the entry within the directory.
+ *  blockNumPtr: set to the number of the block holding the entry.
+ * 
+ * Outputs: 
+ *  A pointer to the entry, or NULL if the directory has no such entry or its block 
+ *  could not be cached.
+ * 
+ */
+struct dir_entry *
+getDirEntryAt(struct inode *inode, int dirInodeNum, int entryIndex, int *blockNumPtr)
+{
+    if ((entryIndex + 1) * (int)sizeof(struct dir_entry) > inode->size) {
+        return NULL;
+    }
+    int blockNum = getNthBlock(inode, dirInodeNum, entryIndex / DIR_ENTRIES_PER_BLOCK, false);
+    if (blockNum == 0) {
+        return NULL;
+    }
+    struct dir_entry *entries = (struct dir_entry *)pinBlock(blockNum, METADATA_POOL);
+    if (entries == NULL) {
+        return NULL;
+    }
+    *blockNumPtr = blockNum;
+    return &entries[entryIndex % DIR_ENTRIES_PER_BLOCK];
+}
+
+/**
+ * This function builds a new hash index for a directory from its entries, with a 
+ * table at most a quarter full, and frees the table of its old index if it had one.
+ * 
+ * Inputs:
+ *  inode: a pointer to the inode of the directory.
+ *  dirInodeNum: the inode number of the directory.
+ *  header: set to the header of the new index.
+ * 
+ * Outputs: 
+ *  True if the index was built, or false if there is no run of free blocks for 
+ *  its table or a block it needs cannot be cached, in which case the directory is 
+ *  left as it was.
+ * 
+ */
+bool
+buildDirIndex(struct inode *inode, int dirInodeNum, dirIndexHeader *header)
+{
+    int entryCount = inode->size / sizeof(struct dir_entry);
+    dirIndexHeader newHeader;
+    newHeader.magic = DIR_INDEX_MAGIC;
+    newHeader.slotCount = MAP_SLOTS;
+    while (newHeader.slotCount < 4 * entryCount) {
+        newHeader.slotCount *= 2;
+    }
+    int tableBlocks = newHeader.slotCount / MAP_SLOTS;
+    newHeader.start = takeFreeBlockRun(tableBlocks);
+    if (newHeader.start == 0) {
+        TRACE_DIR(1, "no room for the index of directory %d\n", dirInodeNum);
+        return false;
+    }
+    newHeader.usedSlots = 0;
+    newHeader.freeHint = entryCount;
+    int i;
+    for (i = 0; i < tableBlocks; i++) {
+        if (getNewBlock(newHeader.start + i, METADATA_POOL) == NULL) {
+            break;
+        }
+        saveBlock(newHeader.start + i);
+    }
+    if (i < tableBlocks) {
+        TRACE_DIR(1, "cannot cache the index of directory %d\n", dirInodeNum);
+        freeDirIndexTable(&newHeader);
+        return false;
+    }
+    
+    // Put every entry in use into the table, giving up if one of the blocks 
+    // cannot be cached, since an index missing an entry would hide it.
+    unsigned int mask = newHeader.slotCount - 1;
+    int entryIndex;
+    for (entryIndex = 0; entryIndex < entryCount; entryIndex++) {
+        int blockNum;
+        struct dir_entry *entry = getDirEntryAt(inode, dirInodeNum, entryIndex, &blockNum);
+        if (entry == NULL) {
+            TRACE_DIR(1, "cannot cache entry %d of directory %d\n", entryIndex, dirInodeNum);
+            freeDirIndexTable(&newHeader);
+            return false;
+        }
+        if (entry->inum == 0) {
+            if (entryIndex < newHeader.freeHint) {
+                newHeader.freeHint = entryIndex;
+            }
+            unpinBlock(blockNum);
+            continue;
+        }
+        unsigned int slot = hashComponent(entry->name) & mask;
+        unpinBlock(blockNum);
+        int slotBlockNum;
+        int *slotPtr = getDirIndexSlot(&newHeader, slot, &slotBlockNum);
+        while (slotPtr != NULL && *slotPtr != 0) {
+            slot = (slot + 1) & mask;
+            slotPtr = getDirIndexSlot(&newHeader, slot, &slotBlockNum);
+        }
+        if (slotPtr == NULL) {
+            TRACE_DIR(1, "cannot cache the index of directory %d\n", dirInodeNum);
+            freeDirIndexTable(&newHeader);
+            return false;
+        }
+        *slotPtr = entryIndex + 1;
+        saveBlock(slotBlockNum);
+        newHeader.usedSlots++;
+    }
+    
+    // Switch to the new index, and then free the table of the old one.
+    dirIndexHeader oldHeader;
+    bool hadIndex = readDirIndexHeader(inode, dirInodeNum, &oldHeader);
+    if (!writeDirIndexHeader(inode, dirInodeNum, &newHeader)) {
+        TRACE_DIR(1, "cannot cache the index header of directory %d\n", dirInodeNum);
+        freeDirIndexTable(&newHeader);
+        return false;
+    }
+    if (hadIndex) {
+        freeDirIndexTable(&oldHeader);
+    }
+    *header = newHeader;
+    TRACE_DIR(1, "indexed directory %d: %d entries in %d slots\n", dirInodeNum, 
+        entryCount, newHeader.slotCount);
+    return true;
+}
+
+/**
+ * This function frees the table of the hash index of a directory, if it has one.
+ * 
+ * Inputs:
+ *  inode: a pointer to the inode of the directory.
+ *  dirInodeNum: the inode number of the directory.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+freeDirIndex(struct inode *inode, int dirInodeNum)
+{
+    dirIndexHeader header;
+    if (!readDirIndexHeader(inode, dirInodeNum, &header)) {
+        return;
+    }
+    freeDirIndexTable(&header);
+    header.magic = 0;
+    writeDirIndexHeader(inode, dirInodeNum, &header);
+}
+
+/**
+ * This function frees the blocks of the table of a hash index.
+ * 
+ * Inputs:
+ *  header: the header of the index.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+freeDirIndexTable(dirIndexHeader *header)
+{
+    int i;
+    for (i = 0; i < header->slotCount / MAP_SLOTS; i++) {
+        addFreeBlock(header->start + i);
+    }
+}
+
+/**
+ * This function looks a name up in a large directory through its hash index, 
+ * building the index first if the directory does not have one yet or if its table 
+ * is more than half full. Slots left by entries that were removed or reused for 
+ * another name are skipped over, and dropped when the index is next rebuilt. When 
+ * the name is not found and createIfNeeded is true, the first free entry from the 
+ * hint on is used, or a new one is added at the end, and indexed under the name.
+ * 
+ * Inputs:
+ *  pathname: the path whose first component is looked up.
+ *  dirInodeNum: the inode number of the directory.
+ *  blockNumPtr: set to the number of the block holding the entry, which is left 
+ *  pinned for the caller as getDirectoryEntry does.
+ *  createIfNeeded: whether to add an entry for the name if it is not found.
+ *  entryPtr: set to the entry, or NULL if it was not found and not created, or if 
+ *  there was no block or cache frame to add it in. Its index is left in dirEntryIndex.
+ * 
+ * Outputs: 
+ *  True if the directory was searched through its index, or false if it has no 
+ *  index and one could not be built, so it must be searched entry by entry.
+ * 
+ */
+bool
+lookupDirIndex(char *pathname, int dirInodeNum, int *blockNumPtr, bool createIfNeeded, 
+    struct dir_entry **entryPtr)
+{
+    struct inode *inode = getInode(dirInodeNum);
+    if (inode == NULL) {
+        return false;
+    }
+    *entryPtr = NULL;
+    dirIndexHeader header;
+    if (!readDirIndexHeader(inode, dirInodeNum, &header) || 
+        header.usedSlots * 2 > header.slotCount) {
+        if (!buildDirIndex(inode, dirInodeNum, &header)) {
+            return false;
+        }
+    }
+    
+    // Probe from the slot the name hashes to up to the first empty one.
+    unsigned int mask = header.slotCount - 1;
+    unsigned int slot = hashComponent(pathname) & mask;
+    int slotBlockNum;
+    int *slotPtr = getDirIndexSlot(&header, slot, &slotBlockNum);
+    while (slotPtr != NULL && *slotPtr != 0) {
+        int blockNum;
+        int foundIndex = *slotPtr - 1;
+        struct dir_entry *entry = getDirEntryAt(inode, dirInodeNum, foundIndex, &blockNum);
+        if (entry == NULL && (foundIndex + 1) * (int)sizeof(struct dir_entry) <= inode->size) {
+            break;
+        }
+        if (entry != NULL) {
+            if (isEqual(pathname, entry->name)) {
+                *blockNumPtr = blockNum;
+                *entryPtr = entry;
+                dirEntryIndex = foundIndex;
+                return true;
+            }
+            unpinBlock(blockNum);
+        }
+        slot = (slot + 1) & mask;
+        slotPtr = getDirIndexSlot(&header, slot, &slotBlockNum);
+    }
+    // A slot or entry that could not be cached ends the search with nothing.
+    if (slotPtr == NULL || *slotPtr != 0) {
+        TRACE_DIR(1, "cannot cache the index of directory %d\n", dirInodeNum);
+        dirEntryUncached = true;
+        return true;
+    }
+    if (!createIfNeeded) {
+        return true;
+    }
+    
+    // Take the first free entry from the hint on, or add one at the end.
+    int entryCount = inode->size / sizeof(struct dir_entry);
+    int entryIndex;
+    int blockNum = 0;
+    struct dir_entry *entry = NULL;
+    for (entryIndex = header.freeHint; entryIndex < entryCount; entryIndex++) {
+        entry = getDirEntryAt(inode, dirInodeNum, entryIndex, &blockNum);
+        if (entry == NULL || entry->inum == 0) {
+            break;
+        }
+        unpinBlock(blockNum);
+        entry = NULL;
+    }
+    if (entry == NULL) {
+        entryIndex = entryCount;
+        if (inode->size % BLOCKSIZE == 0) {
+            // the last block is full, so allocate a new one
+            int newBlockNum = getNthBlock(inode, dirInodeNum, entryIndex / DIR_ENTRIES_PER_BLOCK, true);
+            if (newBlockNum == 0 || getNewBlock(newBlockNum, METADATA_POOL) == NULL) {
+                TRACE_DIR(1, "no block to add an entry to directory %d\n", dirInodeNum);
+                return true;
+            }
+        }
+        inode->size += sizeof(struct dir_entry);
+        entry = getDirEntryAt(inode, dirInodeNum, entryIndex, &blockNum);
+        if (entry == NULL) {
+            inode->size -= sizeof(struct dir_entry);
+            return true;
+        }
+        saveInode(dirInodeNum);
+    }
+    entry->inum = 0;
+    saveBlock(blockNum);
+    
+    // Index the entry under the name; the slot block may have been evicted. An 
+    // entry that cannot be indexed is given back, as if it could not be added.
+    slotPtr = getDirIndexSlot(&header, slot, &slotBlockNum);
+    if (slotPtr == NULL) {
+        TRACE_DIR(1, "cannot cache the index of directory %d\n", dirInodeNum);
+        unpinBlock(blockNum);
+        dirEntryUncached = true;
+        return true;
+    }
+    *slotPtr = entryIndex + 1;
+    saveBlock(slotBlockNum);
+    header.usedSlots++;
+    header.freeHint = entryIndex + 1;
+    writeDirIndexHeader(inode, dirInodeNum, &header);
+    
+    *blockNumPtr = blockNum;
+    *entryPtr = entry;
+    dirEntryIndex = entryIndex;
+    return true;
+}
+
+/**
+ * This function lets the hash index of a directory know that one of its entries 
+ * was freed, so that the next entry created in the directory can reuse it.
+ * 
+ * Inputs:
+ *  dirInodeNum: the inode number of the directory.
+ *  entryIndex: the index of the entry within the directory, as left in dirEntryIndex 
+ *  by getDirectoryEntry.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+releaseDirEntry(int dirInodeNum, int entryIndex)
+{
+    struct inode *inode = getInode(dirInodeNum);
+    dirIndexHeader header;
+    if (inode == NULL || inode->size <= DIR_INDEX_THRESHOLD || 
+        !readDirIndexHeader(inode, dirInodeNum, &header)) {
+        return;
+    }
+    if (entryIndex < header.freeHint) {
+        header.freeHint = entryIndex;
+        writeDirIndexHeader(inode, dirInodeNum, &header);
     }
-    return -1;
 }
 
 /**
@@ -1028,39 +2955,44 @@ yfsCreate(char *pathname, int currentInode, int inodeNumToSet)
         }
         i++;
     }
-    TracePrintf(1, "Creating %s in %d\n", pathname, currentInode);
+    TRACE_DIR(2, "Creating %s in %d\n", pathname, currentInode);
 
     // Get the inode number of the containing directory of the file to be created.
     char *filename;
     int dirInodeNum = getContainingDirectory(pathname, currentInode, &filename);
-    TracePrintf(1, "containind dirInodenum = %d\n", dirInodeNum);
+    TRACE_DIR(2, "containind dirInodenum = %d\n", dirInodeNum);
     if (dirInodeNum == ERROR) {
         return ERROR;
     }
 
     // Check that the containing directory inode is actually a directory.
     struct inode *dirInode = getInode(dirInodeNum);
-    if (dirInode->type != INODE_DIRECTORY) {
+    if (dirInode == NULL || dirInode->type != INODE_DIRECTORY) {
         return ERROR;
     }
 
     // Search all directory entries of that inode for the file name to create.
     int blockNum;
-    TracePrintf(1, "getting directory entry: %s in inode %d\n", filename, dirInodeNum);
-    int offset = getDirectoryEntry(filename, dirInodeNum, &blockNum, true);
-    TracePrintf(1, "offset = %d, blockNum = %d\n", offset, blockNum);
-    void *block = getBlock(blockNum);
-    struct dir_entry *dir_entry = (struct dir_entry *) ((char *)block + offset);
+    TRACE_DIR(2, "getting directory entry: %s in inode %d\n", filename, dirInodeNum);
+    struct dir_entry *dir_entry = getDirectoryEntry(filename, dirInodeNum, &blockNum, true);
+    if (dir_entry == NULL) {
+        return ERROR;
+    }
+    TRACE_DIR(2, "blockNum = %d\n", blockNum);
+    invalidateDcacheEntry(dirInodeNum, filename);
 
     // If the file exists, get the inode, set its size to zero, and return
     // that inode number to user
     int inodeNum = dir_entry->inum;
     if (inodeNum != 0) {
+        unpinBlock(blockNum);
         if (inodeNumToSet != -1) {
             return ERROR;
         }
-        int inodeNum = dir_entry->inum;
         struct inode *inode = getInode(inodeNum);
+        if (inode == NULL) {
+            return ERROR;
+        }
         clearFile(inode, inodeNum);
         
         saveInode(inodeNum);
@@ -1076,18 +3008,25 @@ yfsCreate(char *pathname, int currentInode, int inodeNumToSet)
     for (i = 0; filename[i] != '\0'; i++) {
         dir_entry->name[i] = filename[i];
     }
-    TracePrintf(1, "new directory entry name: %s\n", dir_entry->name);
+    TRACE_DIR(2, "new directory entry name: %s\n", dir_entry->name);
     if (inodeNumToSet == CREATE_NEW) {
         // Create a new inode for the file and set the directory entry to point to it
-        TracePrintf(1, "Creating new!\n");
+        TRACE_DIR(2, "Creating new!\n");
         // Get the next available inode number and set it as the inode number for the file
         inodeNum = getNextFreeInodeNum();
-        TracePrintf(1, "new inodeNum = %d\n", inodeNum);
+        TRACE_DIR(2, "new inodeNum = %d\n", inodeNum);
         dir_entry->inum = inodeNum;
         // Save the changes to the disk
         saveBlock(blockNum);
+        unpinBlock(blockNum);
+        if (inodeNum == 0) {
+            return ERROR;
+        }
         // Get the inode struct for the new file and set its properties
         struct inode *inode = getInode(inodeNum);
+        if (inode == NULL) {
+            return ERROR;
+        }
         inode->type = INODE_REGULAR;
         inode->size = 0;
         inode->nlink = 1;
@@ -1100,19 +3039,114 @@ yfsCreate(char *pathname, int currentInode, int inodeNumToSet)
         dir_entry->inum = inodeNumToSet;
         // Save the changes to the disk
         saveBlock(blockNum);
+        unpinBlock(blockNum);
         // Return the specified inode number
         return inodeNumToSet;
     }
 }
 
+/**
+ * This function reads the given blocks of a file into the data pool ahead of their 
+ * use, skipping those already cached. Blocks read ahead are not counted as used, so 
+ * they are the first to go under CLOCK and are not promoted by 2Q on their first hit.
+ * 
+ * Inputs:
+ *  inode: a pointer to the inode of the file.
+ *  inodeNum: the inode number of the file.
+ *  first: the index within the file of the first block to read.
+ *  last: the index within the file of the last block to read.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+readAheadFile(struct inode *inode, int inodeNum, int first, int last)
+{
+    int n;
+    for (n = first; n <= last; n++) {
+        int blockNum = getNthBlock(inode, inodeNum, n, false);
+        if (blockNum == 0) {
+            break;
+        }
+        if (hash_table_lookup(blockTable, blockNum) != NULL) {
+            continue;
+        }
+        cacheItem *blockItem = getBlockItem(blockNum, DATA_POOL);
+        if (blockItem == NULL) {
+            break;
+        }
+        blockItem->readAhead = true;
+        blockItem->referenced = false;
+        readAheadBlocks++;
+    }
+}
+
+/**
+ * This function updates the sequential read detection of a file after a read, and 
+ * reads ahead the next blocks of the file if it is being read sequentially. A read 
+ * that starts where the last one ended doubles the readahead window up to 
+ * READAHEAD_MAX blocks, a read at the start of the file restarts it at READAHEAD_MIN 
+ * blocks, and any other read collapses it.
+ * 
+ * Inputs:
+ *  inodeNum: an integer representing the inode number of the file that was read.
+ *  inode: a pointer to the inode of the file.
+ *  byteOffset: the byte offset the read started at.
+ *  bytesRead: the number of bytes the read returned.
+ * 
+ * Outputs: None.
+ * 
+ */
+void
+updateReadAhead(int inodeNum, struct inode *inode, int byteOffset, int bytesRead)
+{
+    readAheadState *state = &readAheadStates[inodeNum % READAHEAD_SLOTS];
+    if (state->inodeNum != inodeNum) {
+        state->inodeNum = inodeNum;
+        state->nextOffset = -1;
+        state->window = 0;
+        state->nextBlock = 0;
+    }
+    
+    // Grow the window on sequential reads and collapse it on random ones.
+    // A read from the start of the file starts a new stream.
+    if (byteOffset == state->nextOffset) {
+        state->window = (state->window == 0) ? READAHEAD_MIN : state->window * 2;
+        if (state->window > READAHEAD_MAX) {
+            state->window = READAHEAD_MAX;
+        }
+    } else {
+        state->window = (byteOffset == 0) ? READAHEAD_MIN : 0;
+        state->nextBlock = 0;
+    }
+    state->nextOffset = byteOffset + bytesRead;
+    if (state->window == 0 || bytesRead == 0) {
+        return;
+    }
+    
+    // Read ahead the blocks of the window that were not read ahead before.
+    int lastRead = (byteOffset + bytesRead - 1) / BLOCKSIZE;
+    int first = lastRead + 1;
+    if (state->nextBlock > first) {
+        first = state->nextBlock;
+    }
+    int last = lastRead + state->window;
+    if (first <= last) {
+        readAheadFile(inode, inodeNum, first, last);
+        state->nextBlock = last + 1;
+    }
+}
+
 /**
  * This function reads data from a file starting at the given byte offset and 
- * copies it into a buffer.
+ * copies it into a list of buffers of the calling process, filling each buffer 
+ * before moving on to the next, in one pass over the blocks of the file.
  * 
  * Inputs:
  *  inodeNum: an integer representing the inode number of the file to be read.
- *  buf: a pointer to a buffer where the read data will be copied.
- *  size: an integer representing the number of bytes to be read.
+ *  iov: an array of count buffers in the calling process, already copied into 
+ *  the server.
+ *  count: an integer representing the number of buffers in iov.
  *  byteOffset: an integer representing the byte offset from which to start reading.
  *  pid: an integer representing the process ID of the calling process.
  * 
@@ -1121,15 +3155,13 @@ yfsCreate(char *pathname, int currentInode, int inodeNumToSet)
  * 
  */
 int
-yfsRead(int inodeNum, void *buf, int size, int byteOffset, int pid) 
+readFileV(int inodeNum, struct IoVec *iov, int count, int byteOffset, int pid) 
 {
-    // Check for invalid input parameters.
-    if (buf == NULL || size < 0 || byteOffset < 0 || inodeNum <= 0) {
-        return ERROR;
-    }
-    
     // Get the inode for the specified file.
     struct inode *inode = getInode(inodeNum);
+    if (inode == NULL) {
+        return ERROR;
+    }
     
     // Check if byteOffset is greater than the size of the file.
     if (byteOffset > inode->size) {
@@ -1137,6 +3169,11 @@ yfsRead(int inodeNum, void *buf, int size, int byteOffset, int pid)
     }
     
     // Determine the number of bytes to read.
+    int size = 0;
+    int k;
+    for (k = 0; k < count; k++) {
+        size += iov[k].len;
+    }
     int bytesLeft = size;
     if (inode->size - byteOffset < size) {
         bytesLeft = inode->size - byteOffset;
@@ -1149,118 +3186,333 @@ yfsRead(int inodeNum, void *buf, int size, int byteOffset, int pid)
     int blockOffset = byteOffset % BLOCKSIZE;
 
     int bytesToCopy = BLOCKSIZE - blockOffset;
+
+    // The buffer being filled and how much of it is filled so far.
+    int seg = 0;
+    int segOffset = 0;
     
     // Iterate over each block to read the data.
     int i;
     for (i = byteOffset / BLOCKSIZE; bytesLeft > 0; i++) {
         // Get the block number for the current block.
-        int blockNum = getNthBlock(inode, i, false);
+        int blockNum = getNthBlock(inode, inodeNum, i, false);
         if (blockNum == 0) {
             return ERROR;
         }
         
         // Get the data for the current block.
-        void *currentBlock = getBlock(blockNum);
+        void *currentBlock = getBlock(blockNum, DATA_POOL);
         
         // Determine the number of bytes to copy for the current block.
         if (bytesLeft < bytesToCopy) {
             bytesToCopy = bytesLeft;
         }
         
-        // Copy the data from the current block to the buffer.
-        if (CopyTo(pid, buf, (char *)currentBlock + blockOffset, bytesToCopy) == ERROR)
-        {
-            TracePrintf(1, "error copying %d bytes to pid %d\n", bytesToCopy, pid);
-            return ERROR;
+        // Copy the data from the current block to the buffers it spans.
+        int copied = 0;
+        while (copied < bytesToCopy) {
+            while (segOffset == iov[seg].len) {
+                seg++;
+                segOffset = 0;
+            }
+            int chunk = iov[seg].len - segOffset;
+            if (bytesToCopy - copied < chunk) {
+                chunk = bytesToCopy - copied;
+            }
+            if (CopyTo(pid, (char *)iov[seg].base + segOffset, 
+                (char *)currentBlock + blockOffset + copied, chunk) == ERROR)
+            {
+                TRACE_IPC(1, "error copying %d bytes to pid %d\n", chunk, pid);
+                return ERROR;
+            }
+            segOffset += chunk;
+            copied += chunk;
         }
         
         // Update the offsets and remaining bytes left to read.
-        buf += bytesToCopy;
         blockOffset = 0;
         bytesLeft -= bytesToCopy;
         bytesToCopy = BLOCKSIZE;
     }
-    
-    // Return the number of bytes read.
-    return returnVal;
+    
+    // Read ahead if the file is being read sequentially.
+    updateReadAhead(inodeNum, inode, byteOffset, returnVal);
+    
+    // Return the number of bytes read.
+    return returnVal;
+}
+
+/**
+ * This function writes to a file from a list of buffers of the calling process, 
+ * taking all of each buffer before moving on to the next, in one pass over the 
+ * blocks of the file.
+ * 
+ * Inputs:
+ *  inodeNum: an integer representing the inode number of the file to write to.
+ *  iov: an array of count buffers in the calling process, already copied into 
+ *  the server.
+ *  count: an integer representing the number of buffers in iov.
+ *  byteOffset: an integer representing the starting offset of the write in bytes.
+ *  pid: an integer representing the process ID of the process invoking the write.
+ * 
+ * Outputs: 
+ *  Upon success, returns the number of bytes written to the file.
+ *  Otherwise, returns ERROR.
+ * 
+ * Notes:
+ *  - The function will fail if the inode is not of type INODE_REGULAR.
+ *  - If the write extends beyond the current file size, the file size is updated accordingly.
+ */
+int 
+writeFileV(int inodeNum, struct IoVec *iov, int count, int byteOffset, int pid) 
+{
+    // Get the inode of the file to write to.
+    struct inode *inode = getInode(inodeNum);
+    
+    // Check if the inode is of type INODE_REGULAR.
+    if (inode == NULL || inode->type != INODE_REGULAR) {
+        return ERROR;
+    }
+    
+    int size = 0;
+    int k;
+    for (k = 0; k < count; k++) {
+        size += iov[k].len;
+    }
+
+    int bytesLeft = size;
+    
+    int returnVal = bytesLeft;
+    
+    int blockOffset = byteOffset % BLOCKSIZE;
+
+    int bytesToCopy = BLOCKSIZE - blockOffset;
+
+    // The buffer being written and how much of it is written so far.
+    int seg = 0;
+    int segOffset = 0;
+    
+    int i;
+    // Loop through the blocks to be written to.
+    for (i = byteOffset / BLOCKSIZE; bytesLeft > 0; i++) {
+        // Get the block number to write to, creating it if necessary.
+        bool isNewBlock = (i * BLOCKSIZE >= inode->size);
+        int blockNum = getNthBlock(inode, inodeNum, i, true);
+        if (blockNum == 0) {
+            return ERROR;
+        }
+        
+        // Determine how many bytes to write to the block.
+        if (bytesLeft < bytesToCopy) {
+            bytesToCopy = bytesLeft;
+        }
+        
+        // Get a pointer to the current block. A new block, or an uncached 
+        // block that is overwritten whole, is not read from disk first.
+        bool isOverwrite = (!isNewBlock && bytesToCopy == BLOCKSIZE
+            && hash_table_lookup(blockTable, blockNum) == NULL);
+        void *currentBlock;
+        if (isNewBlock || isOverwrite) {
+            currentBlock = getNewBlock(blockNum, DATA_POOL);
+        } else {
+            currentBlock = getBlock(blockNum, DATA_POOL);
+        }
+        
+        // Copy data from the buffers it spans to the block.
+        int copied = 0;
+        while (copied < bytesToCopy) {
+            while (segOffset == iov[seg].len) {
+                seg++;
+                segOffset = 0;
+            }
+            int chunk = iov[seg].len - segOffset;
+            if (bytesToCopy - copied < chunk) {
+                chunk = bytesToCopy - copied;
+            }
+            if (CopyFrom(pid, (char *)currentBlock + blockOffset + copied, 
+                (char *)iov[seg].base + segOffset, chunk) == ERROR)
+            {
+                TRACE_IPC(1, "error copying %d bytes from pid %d\n", chunk, pid);
+                // Put back the old contents of a block that was not read first.
+                if (isOverwrite) {
+                    ReadSector(blockNum, currentBlock);
+                }
+                return ERROR;
+            }
+            segOffset += chunk;
+            copied += chunk;
+        }
+
+        // Save the block.
+        saveBlock(blockNum);
+        
+        blockOffset = 0;
+        bytesLeft -= bytesToCopy;
+        bytesToCopy = BLOCKSIZE;
+        // Update the file size if necessary.
+        int bytesWrittenSoFar = size - bytesLeft;
+        if (bytesWrittenSoFar + byteOffset > inode->size) {
+            inode->size = bytesWrittenSoFar + byteOffset;
+        }
+    }
+    // Save the inode.
+    saveInode(inodeNum);
+    return returnVal;
+}
+
+/**
+ * This function reads data from a file starting at the given byte offset and 
+ * copies it into a buffer.
+ * 
+ * Inputs:
+ *  inodeNum: an integer representing the inode number of the file to be read.
+ *  buf: a pointer to a buffer where the read data will be copied.
+ *  size: an integer representing the number of bytes to be read.
+ *  byteOffset: an integer representing the byte offset from which to start reading.
+ *  pid: an integer representing the process ID of the calling process.
+ * 
+ * Outputs: 
+ *  Upon success, returns the number of bytes read. Otherwise, returns ERROR.
+ * 
+ */
+int
+yfsRead(int inodeNum, void *buf, int size, int byteOffset, int pid) 
+{
+    // Check for invalid input parameters.
+    if (buf == NULL || size < 0 || byteOffset < 0 || inodeNum <= 0) {
+        return ERROR;
+    }
+    
+    // Read into the buffer as a list of one buffer.
+    struct IoVec iov;
+    iov.base = buf;
+    iov.len = size;
+    return readFileV(inodeNum, &iov, 1, byteOffset, pid);
+}
+
+/**
+ * This function writes to a file.
+ * 
+ * Inputs:
+ *  inodeNum: an integer representing the inode number of the file to write to.
+ *  buf: a pointer to a buffer containing the data to be written.
+ *  size: an integer representing the number of bytes to write.
+ *  byteOffset: an integer representing the starting offset of the write in bytes.
+ *  pid: an integer representing the process ID of the process invoking the write.
+ * 
+ * Outputs: 
+ *  Upon success, returns the number of bytes written to the file.
+ *  Otherwise, returns ERROR.
+ * 
+ * Notes:
+ *  - The function will fail if the inode is not of type INODE_REGULAR.
+ *  - If the write extends beyond the current file size, the file size is updated accordingly.
+ */
+int 
+yfsWrite(int inodeNum, void *buf, int size, int byteOffset, int pid) 
+{
+    // Write from the buffer as a list of one buffer.
+    struct IoVec iov;
+    iov.base = buf;
+    iov.len = size;
+    return writeFileV(inodeNum, &iov, 1, byteOffset, pid);
+}
+
+/**
+ * This function copies a list of buffers in the calling process into the server 
+ * with a single CopyFrom and checks it, for yfsReadV and yfsWriteV.
+ * 
+ * Inputs:
+ *  iov: a pointer to the array of buffers in the calling process.
+ *  count: an integer representing the number of buffers, at most MAX_IOVECS.
+ *  localIov: an array of MAX_IOVECS buffers to copy the list into.
+ *  pid: an integer representing the process ID of the calling process.
+ * 
+ * Outputs: 
+ *  Upon success, returns 0. Otherwise, returns ERROR.
+ * 
+ */
+int
+getIoVecFromProcess(struct IoVec *iov, int count, struct IoVec *localIov, int pid)
+{
+    if (iov == NULL || count < 0 || count > MAX_IOVECS) {
+        return ERROR;
+    }
+    if (CopyFrom(pid, localIov, iov, count * sizeof(struct IoVec)) != 0) {
+        TRACE_IPC(1, "error copying %d buffers from pid %d\n", count, pid);
+        return ERROR;
+    }
+    // Every buffer needs a length that is not negative and an address.
+    int size = 0;
+    int k;
+    for (k = 0; k < count; k++) {
+        if (localIov[k].len < 0 || (localIov[k].len > 0 && localIov[k].base == NULL)) {
+            return ERROR;
+        }
+        size += localIov[k].len;
+        if (size < 0) {
+            return ERROR;
+        }
+    }
+    return 0;
+}
+
+/**
+ * This function reads data from a file starting at the given byte offset into a 
+ * list of buffers of the calling process.
+ * 
+ * Inputs:
+ *  inodeNum: an integer representing the inode number of the file to be read.
+ *  iov: a pointer to the array of buffers in the calling process.
+ *  count: an integer representing the number of buffers, at most MAX_IOVECS.
+ *  byteOffset: an integer representing the byte offset from which to start reading.
+ *  pid: an integer representing the process ID of the calling process.
+ * 
+ * Outputs: 
+ *  Upon success, returns the number of bytes read. Otherwise, returns ERROR.
+ * 
+ */
+int
+yfsReadV(int inodeNum, struct IoVec *iov, int count, int byteOffset, int pid) 
+{
+    // Check for invalid input parameters.
+    if (byteOffset < 0 || inodeNum <= 0) {
+        return ERROR;
+    }
+    struct IoVec localIov[MAX_IOVECS];
+    if (getIoVecFromProcess(iov, count, localIov, pid) == ERROR) {
+        return ERROR;
+    }
+    return readFileV(inodeNum, localIov, count, byteOffset, pid);
 }
 
 /**
- * This function writes to a file.
+ * This function writes to a file starting at the given byte offset from a list of 
+ * buffers of the calling process.
  * 
  * Inputs:
  *  inodeNum: an integer representing the inode number of the file to write to.
- *  buf: a pointer to a buffer containing the data to be written.
- *  size: an integer representing the number of bytes to write.
+ *  iov: a pointer to the array of buffers in the calling process.
+ *  count: an integer representing the number of buffers, at most MAX_IOVECS.
  *  byteOffset: an integer representing the starting offset of the write in bytes.
- *  pid: an integer representing the process ID of the process invoking the write.
+ *  pid: an integer representing the process ID of the calling process.
  * 
  * Outputs: 
- *  Upon success, returns the number of bytes written to the file.
- *  Otherwise, returns ERROR.
+ *  Upon success, returns the number of bytes written. Otherwise, returns ERROR.
  * 
- * Notes:
- *  - The function will fail if the inode is not of type INODE_REGULAR.
- *  - If the write extends beyond the current file size, the file size is updated accordingly.
  */
-int 
-yfsWrite(int inodeNum, void *buf, int size, int byteOffset, int pid) 
+int
+yfsWriteV(int inodeNum, struct IoVec *iov, int count, int byteOffset, int pid) 
 {
-    // Get the inode of the file to write to.
-    struct inode *inode = getInode(inodeNum);
-    
-    // Check if the inode is of type INODE_REGULAR.
-    if (inode->type != INODE_REGULAR) {
+    // Check for invalid input parameters.
+    if (byteOffset < 0 || inodeNum <= 0) {
         return ERROR;
     }
-    
-    int bytesLeft = size;
-    
-    int returnVal = bytesLeft;
-    
-    int blockOffset = byteOffset % BLOCKSIZE;
-
-    int bytesToCopy = BLOCKSIZE - blockOffset;
-    
-    int i;
-    // Loop through the blocks to be written to.
-    for (i = byteOffset / BLOCKSIZE; bytesLeft > 0; i++) {
-        // Get the block number to write to, creating it if necessary.
-        int blockNum = getNthBlock(inode, i, true);
-        if (blockNum == 0) {
-            return ERROR;
-        }
-        // Get a pointer to the current block
-        void *currentBlock = getBlock(blockNum);
-        
-        // Determine how many bytes to write to the block.
-        if (bytesLeft < bytesToCopy) {
-            bytesToCopy = bytesLeft;
-        }
-        
-        // Copy data from the buffer to the block.
-        if (CopyFrom(pid, (char *)currentBlock + blockOffset, buf, bytesToCopy) == ERROR)
-        {
-            TracePrintf(1, "error copying %d bytes from pid %d\n", bytesToCopy, pid);
-            return ERROR;
-        }
-
-        buf += bytesToCopy;
-        // Save the block.
-        saveBlock(blockNum);
-        
-        blockOffset = 0;
-        bytesLeft -= bytesToCopy;
-        bytesToCopy = BLOCKSIZE;
-        // Update the file size if necessary.
-        int bytesWrittenSoFar = size - bytesLeft;
-        if (bytesWrittenSoFar + byteOffset > inode->size) {
-            inode->size = bytesWrittenSoFar + byteOffset;
-        }
+    struct IoVec localIov[MAX_IOVECS];
+    if (getIoVecFromProcess(iov, count, localIov, pid) == ERROR) {
+        return ERROR;
     }
-    // Save the inode.
-    saveInode(inodeNum);
-    return returnVal;
+    return writeFileV(inodeNum, localIov, count, byteOffset, pid);
 }
 
 
@@ -1285,6 +3537,9 @@ yfsSeek(int inodeNum, int offset, int whence, int currentPosition)
 
     // Get the inode for the specified inode number
     struct inode *inode = getInode(inodeNum);
+    if (inode == NULL) {
+        return ERROR;
+    }
 
     // Get the size of the file from the inode
     int size = inode->size;
@@ -1365,7 +3620,7 @@ yfsLink(char *oldName, char *newName, int currentInode)
     struct inode *inode = getInode(oldNameNodeNum);
 
     // If the old file is a directory or the inode number is invalid, return an error
-    if (inode->type == INODE_DIRECTORY || oldNameNodeNum == 0) {
+    if (inode == NULL || inode->type == INODE_DIRECTORY || oldNameNodeNum == 0) {
         return ERROR;
     }
 
@@ -1375,7 +3630,8 @@ yfsLink(char *oldName, char *newName, int currentInode)
         currentInode = ROOTINODE;
     }
 
-    // Create the new file as a hard link to the old file
+    // Create the new file as a hard link to the old file; yfsCreate also drops
+    // the new name from the name cache
     if (yfsCreate(newName, currentInode, oldNameNodeNum) == ERROR) {
         return ERROR;
     }
@@ -1408,25 +3664,31 @@ yfsUnlink(char *pathname, int currentInode)
     // Get the containind directory 
     char *filename;
     int dirInodeNum = getContainingDirectory(pathname, currentInode, &filename);
+    if (dirInodeNum == ERROR) {
+        return ERROR;
+    }
     
     struct inode *dirInode = getInode(dirInodeNum);
-    if (dirInode->type != INODE_DIRECTORY) {
+    if (dirInode == NULL || dirInode->type != INODE_DIRECTORY) {
         return ERROR;
     }
 
+    // Get the directory entry associated with the path
     int blockNum;
-    int offset = getDirectoryEntry(filename, dirInodeNum, &blockNum, false);
-    if (offset == -1) {
+    struct dir_entry *dir_entry = getDirectoryEntry(filename, dirInodeNum, &blockNum, false);
+    if (dir_entry == NULL) {
         return ERROR;
     }
-    void *block = getBlock(blockNum);
-
-    // Get the directory entry associated with the path
-    struct dir_entry *dir_entry = (struct dir_entry *) ((char *)block + offset);
+    int entryIndex = dirEntryIndex;
+    invalidateDcacheEntry(dirInodeNum, filename);
     
     // Get the inode associated with the directory entry
     int inodeNum = dir_entry->inum;
     struct inode *inode = getInode(inodeNum);
+    if (inode == NULL) {
+        unpinBlock(blockNum);
+        return ERROR;
+    }
     
     // Decrease nlinks by 1
     inode->nlink--;
@@ -1441,6 +3703,8 @@ yfsUnlink(char *pathname, int currentInode)
     // Set the inum to zero
     dir_entry->inum = 0;
     saveBlock(blockNum);
+    releaseDirEntry(dirInodeNum, entryIndex);
+    unpinBlock(blockNum);
     
     return 0;
 }
@@ -1469,14 +3733,14 @@ int
 yfsSymLink(char *oldname, char *newname, int currentInode) 
 {
     
+    if (oldname == NULL || newname == NULL || currentInode <= 0) {
+        return ERROR;
+    }
+    
     if (newname[0] == '/') {
         newname += sizeof(char);
         currentInode = ROOTINODE;
     }
-    
-    if (oldname == NULL || newname == NULL || currentInode <= 0) {
-        return ERROR;
-    }
     int i;
     for (i = 0; i < MAXPATHNAMELEN; i++) {
         if (oldname[i] == '\0') {
@@ -1499,12 +3763,16 @@ yfsSymLink(char *oldname, char *newname, int currentInode)
     // create a directory for newname
     char *filename;
     int dirInodeNum = getContainingDirectory(newname, currentInode, &filename);
+    if (dirInodeNum == ERROR) {
+        return ERROR;
+    }
     // Search all directory entries of that inode for the file name to create
     int blockNum;
-    int offset = getDirectoryEntry(filename, dirInodeNum, &blockNum, true);
-    void *block = getBlock(blockNum);
-    
-    struct dir_entry *dir_entry = (struct dir_entry *) ((char *)block + offset);
+    struct dir_entry *dir_entry = getDirectoryEntry(filename, dirInodeNum, &blockNum, true);
+    if (dir_entry == NULL) {
+        return ERROR;
+    }
+    invalidateDcacheEntry(dirInodeNum, filename);
     
     // link that inode to newname
     int inodeNum = getNextFreeInodeNum();
@@ -1515,13 +3783,20 @@ yfsSymLink(char *oldname, char *newname, int currentInode)
         dir_entry->name[i] = filename[i];
     };
     saveBlock(blockNum);
+    unpinBlock(blockNum);
+    if (inodeNum == 0) {
+        return ERROR;
+    }
     struct inode *inode = getInode(inodeNum);
+    if (inode == NULL) {
+        return ERROR;
+    }
     inode->type = INODE_SYMLINK;
     inode->size = sizeof(char) * strlen(oldname);
     inode->nlink = 1;
-    inode->direct[0] = getNextFreeBlockNum();
+    inode->direct[0] = getNearbyFreeBlockNum(inode, inodeNum, 0);
     
-    void *dataBlock = getBlock(inode->direct[0]);
+    void *dataBlock = getNewBlock(inode->direct[0], METADATA_POOL);
     memcpy(dataBlock, oldname, strlen(oldname));
     
     saveBlock(inode->direct[0]);
@@ -1557,7 +3832,7 @@ yfsReadLink(char *pathname, char *buf, int len, int currentInode, int pid)
     }
 
     // Print debugging information
-    TracePrintf(1, "read link for %s, len %d, at inode %d, from pid %d\n", pathname, len, currentInode, pid);
+    TRACE_DIR(2, "read link for %s, len %d, at inode %d, from pid %d\n", pathname, len, currentInode, pid);
     
     // Update currentInode if the pathname is an absolute path
     if (pathname[0] == '/') {
@@ -1573,22 +3848,28 @@ yfsReadLink(char *pathname, char *buf, int len, int currentInode, int pid)
         return ERROR;
     }
     struct inode *symInode = getInode(symInodeNum);
+    if (symInode == NULL) {
+        return ERROR;
+    }
     
     int dataBlockNum = symInode->direct[0];
-    char *dataBlock = (char *)getBlock(dataBlockNum);
-    TracePrintf(1, "data block has string -> %s\n", dataBlock);
+    char *dataBlock = (char *)getBlock(dataBlockNum, METADATA_POOL);
+    if (dataBlock == NULL) {
+        return ERROR;
+    }
+    TRACE_DIR(2, "data block has string -> %s\n", dataBlock);
     
     // Calculate the number of characters to read
     int charsToRead = 0;
     while (charsToRead < len && dataBlock[charsToRead] != '\0') {
         charsToRead++;
     }
-    TracePrintf(1, "copying %d bytes from pid %d\n", charsToRead, pid);
+    TRACE_IPC(2, "copying %d bytes from pid %d\n", charsToRead, pid);
     
     // Copy the data to the buffer
     if (CopyTo(pid, buf, (char *)dataBlock, charsToRead) == ERROR) {
         // Error copying data
-        TracePrintf(1, "error copying %d bytes from pid %d\n", charsToRead, pid);
+        TRACE_IPC(1, "error copying %d bytes from pid %d\n", charsToRead, pid);
         return ERROR;
     }
 
@@ -1622,15 +3903,20 @@ yfsMkDir(char *pathname, int currentInode)
     }
     char *filename;
     int dirInodeNum = getContainingDirectory(pathname, currentInode, &filename);
+    if (dirInodeNum == ERROR) {
+        return ERROR;
+    }
     // Search all directory entries of that inode for the file name to create
     int blockNum;
-    int offset = getDirectoryEntry(filename, dirInodeNum, &blockNum, true);
-    void *block = getBlock(blockNum);
-    
-    struct dir_entry *dir_entry = (struct dir_entry *) ((char *)block + offset);
+    struct dir_entry *dir_entry = getDirectoryEntry(filename, dirInodeNum, &blockNum, true);
+    if (dir_entry == NULL) {
+        return ERROR;
+    }
+    invalidateDcacheEntry(dirInodeNum, filename);
     
     // return error if this directory already exists
     if (dir_entry->inum != 0) {
+        unpinBlock(blockNum);
         return ERROR;
     }
 
@@ -1643,15 +3929,21 @@ yfsMkDir(char *pathname, int currentInode)
     int inodeNum = getNextFreeInodeNum();
     dir_entry->inum = inodeNum;
     saveBlock(blockNum);
-    block = getInodeBlockNum(inodeNum);
+    unpinBlock(blockNum);
+    if (inodeNum == 0) {
+        return ERROR;
+    }
     
     struct inode *inode = getInode(inodeNum);
+    if (inode == NULL) {
+        return ERROR;
+    }
     inode->type = INODE_DIRECTORY;
     inode->size = 2 * sizeof (struct dir_entry);
     inode->nlink = 1;
     
-    int firstDirectBlockNum = getNextFreeBlockNum();
-    void *firstDirectBlock = getBlock(firstDirectBlockNum);
+    int firstDirectBlockNum = getNearbyFreeBlockNum(inode, inodeNum, 0);
+    void *firstDirectBlock = getNewBlock(firstDirectBlockNum, METADATA_POOL);
     inode->direct[0] = firstDirectBlockNum;
     
     struct dir_entry *dir1 = (struct dir_entry *)firstDirectBlock;
@@ -1698,27 +3990,35 @@ yfsRmDir(char *pathname, int currentInode)
     }
     struct inode *inode = getInode(inodeNum);
     
-    if (inode->size > (int)(2*sizeof(struct dir_entry))) {
+    if (inode == NULL || inode->size > (int)(2*sizeof(struct dir_entry))) {
         return ERROR;
     }
     
     clearFile(inode, inodeNum);
-    addFreeInodeToList(inodeNum);
+    addFreeInode(inodeNum);
+    invalidateDcacheDirectory(inodeNum);
     
     
     char *filename;
     int dirInodeNum = getContainingDirectory(pathname, currentInode, &filename);
-
-    int blockNum;
-    int offset = getDirectoryEntry(filename, dirInodeNum, &blockNum, true);
-    void *block = getBlock(blockNum);
+    if (dirInodeNum == ERROR) {
+        return ERROR;
+    }
 
     // Get the directory entry associated with the path
-    struct dir_entry *dir_entry = (struct dir_entry *) ((char *)block + offset);
+    int blockNum;
+    struct dir_entry *dir_entry = getDirectoryEntry(filename, dirInodeNum, &blockNum, true);
+    if (dir_entry == NULL) {
+        return ERROR;
+    }
+    int entryIndex = dirEntryIndex;
+    invalidateDcacheEntry(dirInodeNum, filename);
     
     // Set the inum to zero
     dir_entry->inum = 0;
     saveBlock(blockNum);
+    releaseDirEntry(dirInodeNum, entryIndex);
+    unpinBlock(blockNum);
     return 0;
 }
 
@@ -1796,6 +4096,9 @@ yfsStat(char *pathname, int currentInode, struct Stat *statbuf, int pid)
 
     // get the inode and populate the statbuf
     struct inode *inode = getInode(inodeNum);
+    if (inode == NULL) {
+        return ERROR;
+    }
     struct Stat stat;
     stat.inum = inodeNum;
     stat.nlink = inode->nlink;
@@ -1804,7 +4107,7 @@ yfsStat(char *pathname, int currentInode, struct Stat *statbuf, int pid)
 
     // copy the statbuf to the process's memory
     if (CopyTo(pid, statbuf, &stat, sizeof(struct Stat)) == ERROR) {
-        TracePrintf(1, "error copying %d bytes to pid %d\n", sizeof(struct Stat), pid);
+        TRACE_IPC(1, "error copying %d bytes to pid %d\n", sizeof(struct Stat), pid);
         return ERROR;
     }
 
@@ -1812,6 +4115,290 @@ yfsStat(char *pathname, int currentInode, struct Stat *statbuf, int pid)
     return 0;
 }
 
+/**
+ * This function lists a directory into a buffer of the calling process, packing as 
+ * many struct DirRecord as fit, each with the attributes of the entry's inode and 
+ * the target of a symbolic link, so a listing takes one request per buffer instead 
+ * of a Read, a Stat and a ReadLink per entry.
+ * 
+ * Inputs:
+ *  inodeNum: an integer representing the inode number of the directory.
+ *  buf: a pointer to the buffer in the calling process to fill with records.
+ *  size: an integer representing the size of the buffer in bytes.
+ *  cookie: the byte offset in the directory of the first entry to list, 0 or the 
+ *  cookie of the last record of a previous call.
+ *  pid: an integer representing the process ID of the calling process.
+ * 
+ * Outputs: 
+ *  Upon success, returns the number of bytes of records copied, 0 once the whole 
+ *  directory has been listed. Otherwise, returns ERROR, also when the buffer is too 
+ *  small for the next record.
+ * 
+ * Notes:
+ *  - Records are staged a block at a time and copied out with one CopyTo each.
+ *  - Entry inodes and link targets are copied out of their blocks right away, so 
+ *    a long listing does not keep every inode block it reads pinned.
+ */
+int
+yfsReadDir(int inodeNum, void *buf, int size, int cookie, int pid)
+{
+    // Check for invalid input parameters.
+    if (buf == NULL || size < 0 || cookie < 0 || inodeNum <= 0
+        || cookie % sizeof(struct dir_entry) != 0) {
+        return ERROR;
+    }
+
+    // Get the inode of the directory.
+    struct inode *inode = getInode(inodeNum);
+    if (inode == NULL || inode->type != INODE_DIRECTORY) {
+        return ERROR;
+    }
+    TRACE_DIR(2, "read dir %d from %d into %d bytes for pid %d\n", inodeNum, cookie, size, pid);
+
+    char records[BLOCKSIZE];
+    int staged = 0;
+    int copied = 0;
+    int entryIndex;
+    for (entryIndex = cookie / sizeof(struct dir_entry); ; entryIndex++) {
+        // Get the next entry, stopping at the end of the directory.
+        int blockNum;
+        struct dir_entry *entry = getDirEntryAt(inode, inodeNum, entryIndex, &blockNum);
+        if (entry == NULL) {
+            break;
+        }
+        int entryInodeNum = entry->inum;
+        char name[DIRNAMELEN + 1];
+        memcpy(name, entry->name, DIRNAMELEN);
+        name[DIRNAMELEN] = '\0';
+        unpinBlock(blockNum);
+        if (entryInodeNum == 0) {
+            continue;
+        }
+
+        // Copy the inode of the entry out of its inode block.
+        struct inode *inodes = (struct inode *)getInodeBlockNum(entryInodeNum);
+        if (inodes == NULL) {
+            return ERROR;
+        }
+        struct inode entryInode = inodes[entryInodeNum % INODESPERBLOCK];
+
+        // Work out the size of the record, with room for the target of a link.
+        int linkLen = 0;
+        if (entryInode.type == INODE_SYMLINK) {
+            linkLen = (entryInode.size < MAXPATHNAMELEN) ? entryInode.size : MAXPATHNAMELEN - 1;
+        }
+        int recordLen = sizeof(struct DirRecord);
+        if (linkLen > 0) {
+            recordLen += linkLen + 1;
+        }
+        recordLen = (recordLen + sizeof(int) - 1) & ~(int)(sizeof(int) - 1);
+
+        // Stop when the caller's buffer is full, and copy out the staged
+        // records when the staging buffer is.
+        if (copied + staged + recordLen > size) {
+            if (copied + staged == 0) {
+                TRACE_DIR(1, "read dir buffer of %d bytes too small for a record\n", size);
+                return ERROR;
+            }
+            break;
+        }
+        if (staged + recordLen > BLOCKSIZE) {
+            if (CopyTo(pid, (char *)buf + copied, records, staged) == ERROR) {
+                TRACE_IPC(1, "error copying %d bytes to pid %d\n", staged, pid);
+                return ERROR;
+            }
+            copied += staged;
+            staged = 0;
+        }
+
+        // Fill in the record.
+        struct DirRecord *record = (struct DirRecord *)(records + staged);
+        memset(record, 0, recordLen);
+        record->reclen = recordLen;
+        record->cookie = (entryIndex + 1) * sizeof(struct dir_entry);
+        record->inum = entryInodeNum;
+        record->type = entryInode.type;
+        record->nlink = entryInode.nlink;
+        record->size = entryInode.size;
+        record->linklen = linkLen;
+        memcpy(record->name, name, DIRNAMELEN + 1);
+        if (linkLen > 0) {
+            char *target = (char *)getBlock(entryInode.direct[0], METADATA_POOL);
+            if (target == NULL) {
+                return ERROR;
+            }
+            memcpy((char *)(record + 1), target, linkLen);
+        }
+        staged += recordLen;
+    }
+
+    // Copy out the records still staged.
+    if (staged > 0) {
+        if (CopyTo(pid, (char *)buf + copied, records, staged) == ERROR) {
+            TRACE_IPC(1, "error copying %d bytes to pid %d\n", staged, pid);
+            return ERROR;
+        }
+        copied += staged;
+    }
+    return copied;
+}
+
+/**
+ * This function looks up a path for a client that caches attributes, returning the 
+ * attributes of the file in the reply along with the generation of the lookup and a 
+ * lease: the number of times the client may use them before asking again.
+ * 
+ * Inputs:
+ *  pathname: a string representing the path to look up.
+ *  currentInode: an integer representing the inode number of the current directory.
+ *  generation: the generation of the attributes the client has cached for the path, 
+ *  whose lease it wants renewed, or 0.
+ *  reply: the reply to fill in.
+ * 
+ * Outputs: 
+ *  Upon success, returns the inode number of the file. Otherwise, returns ERROR.
+ * 
+ * Notes:
+ *  - The generation of a lookup is the newest generation of the directories, links 
+ *    and file it went through, so it changes whenever anything that the path or the 
+ *    attributes depend on changes. A lease on an older generation is refused.
+ *  - A renewed lease is for LEASE_MAX_USES uses. A new one is for as many uses as 
+ *    requests since that newest change, up to LEASE_MAX_USES, so a path that has 
+ *    just changed is cached for a short time or not at all until it settles.
+ * 
+ */
+int
+yfsLookup(char *pathname, int currentInode, int generation, struct message_reply *reply)
+{
+    // check for valid inputs
+    if (pathname == NULL || currentInode <= 0 || reply == NULL) {
+        return ERROR;
+    }
+
+    // if the path is absolute, reset the currentInode to the root inode
+    if (pathname[0] == '/') {
+        while (pathname[0] == '/')
+            pathname += sizeof(char);
+        currentInode = ROOTINODE;
+    }
+
+    // get the inode number for the specified path, noting the generations met
+    numSymLinks = 0;
+    lookupGeneration = 0;
+    lookupChangedAt = 0;
+    int inodeNum = getPathInodeNumber(pathname, currentInode);
+    if (inodeNum == 0) {
+        return ERROR;
+    }
+    noteLookupInode(inodeNum);
+
+    // renew the lease in full if nothing changed since it was granted, and 
+    // otherwise refuse it and grant a new one as long as the path has been stable
+    int lease = requestCount - lookupChangedAt;
+    if (generation == lookupGeneration) {
+        leaseRenewals++;
+        lease = LEASE_MAX_USES;
+    } else if (generation != 0) {
+        leaseRefusals++;
+    }
+    if (lease > LEASE_MAX_USES) {
+        lease = LEASE_MAX_USES;
+    }
+
+    // fill in the attributes and the lease
+    struct inode *inode = getInode(inodeNum);
+    if (inode == NULL) {
+        return ERROR;
+    }
+    reply->generation = lookupGeneration;
+    reply->type = inode->type;
+    reply->size = inode->size;
+    reply->nlink = inode->nlink;
+    reply->lease = lease;
+    reply->reuse = inode->reuse;
+    TRACE_DIR(2, "lookup %s: inode %d, generation %d, lease %d\n", pathname, inodeNum, 
+        lookupGeneration, lease);
+    return inodeNum;
+}
+
+/**
+ * This function fills in the reply to a request on an open file with the size of the 
+ * file, its generation and a lease on them, so that the client can seek in the file 
+ * without asking the server.
+ * 
+ * Inputs:
+ *  inodeNum: the inode number of the file.
+ *  generation: the generation of the file the client presented with the request, or 0.
+ *  current: the generation of the file when the request arrived.
+ *  reply: the reply to fill in.
+ * 
+ * Outputs: None.
+ * 
+ * Notes:
+ *  - The lease is renewed in full if the client knew the file as it was when the 
+ *    request arrived, since any change since then is the request's own. Otherwise it 
+ *    is for as many uses as requests since the file last changed, as for yfsLookup.
+ * 
+ */
+void
+fillFileReply(int inodeNum, int generation, int current, struct message_reply *reply)
+{
+    if (inodeNum <= 0 || inodeNum >= numGenerations || reply == NULL) {
+        return;
+    }
+
+    // renew the lease if the client was up to date, and otherwise grant one as 
+    // long as the file has been stable
+    int lease = requestCount - inodeChangedAt[inodeNum];
+    if (generation != 0 && generation == current) {
+        leaseRenewals++;
+        lease = LEASE_MAX_USES;
+    } else if (generation != 0) {
+        leaseRefusals++;
+    }
+    if (lease > LEASE_MAX_USES) {
+        lease = LEASE_MAX_USES;
+    }
+
+    // fill in the size of the file and the lease
+    struct inode *inode = getInode(inodeNum);
+    if (inode == NULL) {
+        return;
+    }
+    reply->generation = inodeGenerations[inodeNum];
+    reply->type = inode->type;
+    reply->size = inode->size;
+    reply->nlink = inode->nlink;
+    reply->lease = lease;
+    reply->reuse = inode->reuse;
+}
+
+/**
+ * This function checks that an inode a client has open is still the file it opened: 
+ * that it has not been freed, nor freed and used again for another file since.
+ * 
+ * Inputs:
+ *  inodeNum: the inode number of the open file.
+ *  reuse: the reuse count of the inode when the client opened it, or 0 if the client 
+ *  does not know it.
+ * 
+ * Outputs: 
+ *  True if the inode is still the file the client opened. Otherwise, false.
+ * 
+ */
+bool
+isOpenInode(int inodeNum, int reuse)
+{
+    if (inodeNum <= 0 || inodeNum >= numGenerations) {
+        return false;
+    }
+    struct inode *inode = getInode(inodeNum);
+    if (inode == NULL || inode->type == INODE_FREE) {
+        return false;
+    }
+    return (reuse == 0 || inode->reuse == reuse);
+}
+
 /**
  * This function synchronizes all dirty blocks and inodes with the disk.
  * 
@@ -1821,43 +4408,42 @@ yfsStat(char *pathname, int currentInode, struct Stat *statbuf, int pid)
  *  Upon success, returns 0. Otherwise, returns ERROR.
  * 
  * Notes:
- *  - Iterates over all the items in the cacheBlockQueue and cacheInodeQueue and
-      writes back the dirty blocks and inodes respectively to the disk.
-    - Uses WriteSector function to write back dirty blocks to disk.
-    - Uses memcpy function to copy dirty inodes into their corresponding block.
+ *  - Only visits the items on the dirtyBlocks list, so the cost depends on how much 
+ *    changed rather than on the size of the cache.
+ *  - Dirty inodes need no separate pass, since inodes live in their cached inode 
+ *    blocks and saveInode marks those blocks dirty.
+ *  - Uses WriteSector function to write back dirty blocks to disk in ascending 
+ *    sector order, marking each clean once it has been written.
+ *  - Also writes the changed blocks of the on-disk free bitmaps.
  * 
  */
 int
 yfsSync(void) 
 {
-    TracePrintf(1, "About to sync all dirty blocks and inodes\n");
-    // First sync all dirty blocks
-    cacheItem *currBlockItem = cacheBlockQueue->firstItem;
-    while (currBlockItem != NULL) {
-        if (currBlockItem->dirty) {
-            //write this block back to disk
-            WriteSector(currBlockItem->number, currBlockItem->addr);
+    TRACE_CACHE(2, "About to sync all dirty blocks and inodes\n");
+    // Write all dirty blocks back to disk, lowest sector first
+    qsort(dirtyBlocks, dirtyBlockCount, sizeof(cacheItem *), compareCacheItems);
+    int failedCount = 0;
+    int i;
+    for (i = 0; i < dirtyBlockCount; i++) {
+        cacheItem *currBlockItem = dirtyBlocks[i];
+        if (WriteSector(currBlockItem->number, currBlockItem->addr) != 0) {
+            // Keep the block dirty so the next sync retries it.
+            TRACE_CACHE(1, "error writing block %d\n", currBlockItem->number);
+            currBlockItem->dirtyIndex = failedCount;
+            dirtyBlocks[failedCount++] = currBlockItem;
+        } else {
+            currBlockItem->dirty = false;
         }
-        currBlockItem = currBlockItem->nextItem;
     }
+    dirtyBlockCount = failedCount;
     
-    // Now sync all dirty inodes
-    cacheItem *currInodeItem = cacheInodeQueue->firstItem;
-    while (currInodeItem != NULL) {
-        if (currInodeItem->dirty) {
-            int inodeNum = currInodeItem->number;
-            int blockNum = (inodeNum / INODESPERBLOCK) + 1;
-
-            void *block = getBlock(blockNum);
-            void *inodeAddrInBlock = (block + (inodeNum - (blockNum - 1) * INODESPERBLOCK) * INODESIZE);
-
-            memcpy(inodeAddrInBlock, currInodeItem->addr, sizeof(struct inode));
-            WriteSector(blockNum, block);
-        }
-        currInodeItem = currInodeItem->nextItem;
+    // Then write the blocks of the free bitmaps that changed
+    if (freeMapStart != 0) {
+        failedCount += writeFreeMaps();
     }
-    TracePrintf(1, "Done syncing\n");
-    return 0;
+    TRACE_CACHE(2, "Done syncing\n");
+    return (failedCount == 0) ? 0 : ERROR;
  }
 
 /**
@@ -1870,14 +4456,33 @@ yfsSync(void)
  * 
  * Notes:
  *  - Calls yfsSync() to sync all dirty blocks and inodes before shutting down.
+ *  - Traces the block cache counters and the average extent length of the 
+ *    blocks allocated, as a measure of fragmentation.
  *  - Exits with status 0 to shutdown the server.
  * 
  */
 int
 yfsShutdown(void) 
 {
-    yfsSync();
-    TracePrintf(1, "About to shutdown the YFS file system server...\n");
+    // Only mark the file system clean if everything made it to disk.
+    if (yfsSync() == 0 && freeMapStart != 0) {
+        writeFsHeader(1);
+    }
+    cachePool *meta = &cachePools[METADATA_POOL];
+    cachePool *data = &cachePools[DATA_POOL];
+    TRACE_CACHE(0, "block cache (%s): %d hits, %d misses, metadata %d/%d, data %d/%d, %d read ahead\n",
+        (cachePolicy == CACHE_2Q) ? "2q" : (cachePolicy == CACHE_CLOCK) ? "clock" : "lru",
+        meta->hits + data->hits, meta->misses + data->misses,
+        meta->hits, meta->misses, data->hits, data->misses, readAheadBlocks);
+    TRACE_DIR(0, "name cache: %d name hits, %d name misses, %d leases renewed, %d refused\n", 
+        dcacheHits, dcacheMisses, leaseRenewals, leaseRefusals);
+    // Average extent length, in hundredths of a block, of the blocks allocated.
+    int extentLength = (allocatedExtentCount == 0) ? 0 : 
+        allocatedBlockCount * 100 / allocatedExtentCount;
+    TRACE_ALLOC(0, "block allocation (window %d): %d blocks in %d extents over %d files, %d.%02d blocks per extent\n",
+        reserveWindow, allocatedBlockCount, allocatedExtentCount, allocatedFileCount,
+        extentLength / 100, extentLength % 100);
+    TRACE_IPC(1, "About to shutdown the YFS file system server...\n");
     Exit(0);
 }
 
@@ -1895,8 +4500,29 @@ yfsShutdown(void)
 int
 main(int argc, char **argv)
 {
-    (void) argc;
-    (void) argv;
+    // Options before the first program: "-c lru", "-c 2q" or "-c clock" 
+    // picks the block cache replacement policy, and "-r blocks" sets the
+    // window of blocks reserved ahead of each file being written.
+    while (argc > 2 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "-c") == 0) {
+            if (strcmp(argv[2], "2q") == 0) {
+                cachePolicy = CACHE_2Q;
+            } else if (strcmp(argv[2], "clock") == 0) {
+                cachePolicy = CACHE_CLOCK;
+            } else if (strcmp(argv[2], "lru") != 0) {
+                TRACE_CACHE(0, "unknown cache policy %s, using lru\n", argv[2]);
+            }
+        } else if (strcmp(argv[1], "-r") == 0) {
+            reserveWindow = atoi(argv[2]);
+            if (reserveWindow < 0) {
+                reserveWindow = 0;
+            }
+        } else {
+            break;
+        }
+        argc -= 2;
+        argv += 2;
+    }
     init();
 
     if (argc > 1) {
@@ -1905,6 +4531,8 @@ main(int argc, char **argv)
         } else {
             for (;;) {
                 processRequest(); 
+                releaseRequestPins();
+                requestCount++;
             }
         }
     }
@@ -1,34 +1,109 @@
 #include <stdbool.h>
+#include <stdint.h>
 #include <comp421/iolib.h>
 
 #define INODESPERBLOCK (BLOCKSIZE / INODESIZE)
 #define CREATE_NEW -1
+#define CACHELINESIZE 64
+#define WRITEBACK_CLUSTER 8
+
+/* Block cache replacement policies, and the number of 2Q ghosts per pool. */
+#define CACHE_LRU 0
+#define CACHE_2Q 1
+#define CACHE_CLOCK 2
+#define GHOST_SIZE (BLOCK_CACHESIZE / 2)
+
+/* Block cache pools, and how the cache's frames are split between them. */
+#define METADATA_POOL 0
+#define DATA_POOL 1
+#define NUM_POOLS 2
+#define METADATA_CACHESIZE (BLOCK_CACHESIZE / 2)
+#define DATA_CACHESIZE (BLOCK_CACHESIZE - METADATA_CACHESIZE)
+
+/* 
+ * Most inode blocks one request can hold pinned, so that the rest of the metadata 
+ * pool stays free for the blocks pinned while a request walks a file or directory.
+ */
+#define REQUEST_PIN_MAX (METADATA_CACHESIZE * 3 / 4)
+
+/* Sequential readahead: files tracked at once, and the readahead window in blocks. */
+#define READAHEAD_SLOTS 16
+#define READAHEAD_MIN 2
+#define READAHEAD_MAX (DATA_CACHESIZE / 2)
+
+/* Block allocation: files holding a reservation at once, and the default window in blocks. */
+#define RESERVE_SLOTS 16
+#define RESERVE_WINDOW 8
+
+/* 
+ * Map blocks: block numbers in a map block, the levels of map blocks below the 
+ * indirect block, and the slots of the indirect block that hold the double and 
+ * triple indirect blocks instead of blocks of the file.
+ */
+#define MAP_SLOTS (BLOCKSIZE / (int)sizeof(int))
+#define MAP_LEVELS 3
+#define NUM_SINGLE (MAP_SLOTS - 2)
+#define DOUBLE_SLOT NUM_SINGLE
+#define TRIPLE_SLOT (NUM_SINGLE + 1)
+
+/* Directory name lookup cache entries, direct mapped by a hash of the parent inode and name. */
+#define DCACHE_SLOTS 256
+
+/* Most uses of cached attributes a client is granted by a lease. */
+#define LEASE_MAX_USES 64
+
+/* 
+ * Hashed directory index: entries per directory block, the size in bytes above 
+ * which a directory gets an index, the magic number of the index header kept in 
+ * the unused name bytes of its "." entry, and where in those bytes it is kept.
+ */
+#define DIR_ENTRIES_PER_BLOCK (BLOCKSIZE / (int)sizeof(struct dir_entry))
+#define DIR_INDEX_THRESHOLD (4 * BLOCKSIZE)
+#define DIR_INDEX_MAGIC 0x79646978
+#define DIR_INDEX_OFFSET 2
+
+/* Magic number in the file system header once it describes the free bitmaps. */
+#define YFS_MAGIC 0x79667331
 
 /* Defining Struct Types. */
-typedef struct freeInode freeInode;
-typedef struct freeBlock freeBlock;
 typedef struct cacheItem cacheItem;
 typedef struct queue queue;
+typedef struct cachePool cachePool;
+typedef struct readAheadState readAheadState;
+typedef struct blockReservation blockReservation;
+typedef struct dcacheEntry dcacheEntry;
+typedef struct dirIndexHeader dirIndexHeader;
 
 /* Struct for items in the cache. */ 
 struct cacheItem {
     int number; // block number
     bool dirty; // dirty flag to track changes to the block
+    int dirtyIndex; // position in the dirty block list while dirty
+    int pins; // number of holders that keep the block from being evicted
+    bool requestPinned; // whether the current request holds one of the pins
+    bool onProbation; // whether the block is in the 2Q probation queue
+    int firstRequest; // request that read the block into the cache
+    bool referenced; // CLOCK reference bit, set on every use of the block
+    bool readAhead; // whether the block was read ahead and not used yet
     void *addr; // pointer to block data
+    cachePool *pool; // pool that owns the frame
     cacheItem *prevItem; // pointer to previous item in the cache
     cacheItem *nextItem; // pointer to next item in the cache
 };
 
-/* Struct for free inodes. */
-struct freeInode {
-    int inodeNumber; // inode number
-    freeInode *next; // pointer to next free inode in the list
-};
-
-/* Struct for free blocks. */
-struct freeBlock {
-    int blockNumber; // block number
-    freeBlock *next; // pointer to next free block in the list
+/* 
+ * Layout of the file system header used by the server. It is struct fs_header 
+ * with the location of the free inode and block bitmaps and the clean-unmount 
+ * flag kept in its padding, which mkyfs leaves zeroed.
+ */
+struct yfs_header {
+    int num_blocks; // number of blocks on the disk
+    int num_inodes; // number of inodes
+    int magic; // YFS_MAGIC once the fields below are valid
+    int clean; // 1 if the server shut down cleanly since the bitmaps were written
+    int map_start; // first block of the free bitmaps, inode bitmap first
+    int map_blocks; // number of blocks holding the free bitmaps
+    char padding[40];
 };
 
 /* Struct for a queue of cache items. */
@@ -37,18 +112,127 @@ struct queue {
     cacheItem *lastItem; // pointer to last item in the queue
 };
 
+/* Struct for a pool of block cache frames with its own capacity and eviction. */
+struct cachePool {
+    queue *blockQueue; // blocks in least recently used order
+    queue *probationQueue; // 2Q blocks used by only one request so far
+    int probationSize; // number of blocks on probation
+    int ghostBlocks[GHOST_SIZE]; // blocks recently evicted from probation
+    int ghostNext; // next ghost slot to overwrite
+    cacheItem *items; // the pool's frames, swept by the CLOCK hand
+    int clockHand; // index of the next frame the CLOCK hand looks at
+    cacheItem *freeItems; // items not holding a block yet
+    int size; // number of blocks held
+    int capacity; // number of frames in the pool
+    int hits; // lookups that found the block in this pool
+    int misses; // blocks read from disk into this pool
+};
+
+/* Struct for the sequential read detection of a file. */
+struct readAheadState {
+    int inodeNum; // file being tracked, or 0
+    int nextOffset; // byte offset just past the last read of the file
+    int window; // number of blocks to read ahead, 0 while reads are not sequential
+    int nextBlock; // index of the first block of the file not read ahead yet
+};
+
+/* Struct for a name cached from a directory, or the fact that the directory does not have it. */
+struct dcacheEntry {
+    int parentInodeNum; // directory holding the name, or 0 if the entry is unused
+    int inodeNum; // inode the name refers to, or 0 if the directory has no such name
+    char name[DIRNAMELEN]; // the name, padded with '\0' like the name of a dir_entry
+};
+
+/* 
+ * Struct for the header of the hash index of a directory. The index is a table of 
+ * slots in a run of blocks, each 0 or the index within the directory plus 1 of an 
+ * entry whose name hashed to that slot or, by linear probing, a slot before it.
+ */
+struct dirIndexHeader {
+    int magic; // DIR_INDEX_MAGIC while the directory has an index
+    int start; // first block of the table of slots
+    int slotCount; // number of slots, a power of two and at least MAP_SLOTS
+    int usedSlots; // number of slots that are not 0
+    int freeHint; // index of an entry before which no entry is free
+};
+
+/* Struct for the window of blocks reserved for the next blocks of a file. */
+struct blockReservation {
+    int inodeNum; // file holding the reservation, or 0
+    int start; // first block of the window
+    int end; // block just past the window
+};
+
 /* Function Prototypes. */
-void *getBlock(int blockNumber);
-void destroyCacheItem(cacheItem *item);
+void initBlockArena(void);
+void markDirty(cacheItem *item);
+void markClean(cacheItem *item);
+void pinForRequest(cacheItem *item);
+void releaseRequestPins(void);
+void *pinBlock(int blockNumber, int type);
+void unpinBlock(int blockNumber);
+int writeBackCluster(cacheItem *item);
+cacheItem *findUnpinnedItem(queue *queue);
+cacheItem *sweepClock(cachePool *pool);
+cacheItem *chooseVictim(cachePool *pool);
+bool forgetGhost(cachePool *pool, int blockNumber);
+cacheItem *getBlockItem(int blockNumber, int type);
+cacheItem *allocateCacheItem(int blockNumber, int type);
+void *getNewBlock(int blockNumber, int type);
+void *getBlock(int blockNumber, int type);
+void readAheadFile(struct inode *inode, int inodeNum, int first, int last);
+void updateReadAhead(int inodeNum, struct inode *inode, int byteOffset, int bytesRead);
 struct inode* getInode(int inodeNum);
-void addFreeInodeToList(int inodeNum);
-void buildFreeInodeAndBlockLists();
+int takeFirstSetBit(uint64_t *map, int words, int *hint);
+bool setBit(uint64_t *map, int index, int *hint);
+void addFreeInode(int inodeNum);
+void addFreeBlock(int blockNum);
+void markFreeMapDirty(uint64_t *word);
+int writeFreeMaps(void);
+int writeFsHeader(int clean);
+int takeFreeBlockRun(int count);
+bool isFreeBlock(int blockNum);
+void takeFreeBlock(int blockNum);
+bool isReservedByOther(int blockNum, int inodeNum);
+void reserveBlocks(int inodeNum, int start);
+void releaseReservation(int inodeNum);
+int findFreeWindow(int goal, int inodeNum);
+int getNearbyFreeBlockNum(struct inode *inode, int inodeNum, int n);
+int allocateMapBlock(int inodeNum, int goal);
+int getBlockPath(int n, int *path);
+int getFirstMapBlocks(struct inode *inode, int n, int *mapBlocks);
+unsigned int hashComponent(char *name);
+int hashName(int parentInodeNum, char *name);
+bool readDirIndexHeader(struct inode *inode, int dirInodeNum, dirIndexHeader *header);
+bool writeDirIndexHeader(struct inode *inode, int dirInodeNum, dirIndexHeader *header);
+int *getDirIndexSlot(dirIndexHeader *header, int slot, int *blockNumPtr);
+struct dir_entry *getDirEntryAt(struct inode *inode, int dirInodeNum, int entryIndex, int *blockNumPtr);
+bool buildDirIndex(struct inode *inode, int dirInodeNum, dirIndexHeader *header);
+void freeDirIndex(struct inode *inode, int dirInodeNum);
+void freeDirIndexTable(dirIndexHeader *header);
+bool lookupDirIndex(char *pathname, int dirInodeNum, int *blockNumPtr, bool createIfNeeded, 
+    struct dir_entry **entryPtr);
+void releaseDirEntry(int dirInodeNum, int entryIndex);
+dcacheEntry *lookupDcache(int parentInodeNum, char *name);
+void addDcacheEntry(int parentInodeNum, char *name, int inodeNum);
+void invalidateDcacheEntry(int parentInodeNum, char *name);
+void invalidateDcacheDirectory(int dirInodeNum);
+void initGenerations(int numInodes);
+void changeGeneration(int inodeNum);
+void noteLookupInode(int inodeNum);
+int getGeneration(int inodeNum);
+void buildFreeInodeAndBlockMaps();
 int getNextFreeBlockNum();
-int getDirectoryEntry(char *pathname, int inodeStartNumber, int *blockNumPtr, bool createIfNeeded);
+struct dir_entry *getDirectoryEntry(char *pathname, int inodeStartNumber, int *blockNumPtr, bool createIfNeeded);
 int yfsCreate(char *pathname, int currentInode, int inodeNumToSet);
 int yfsOpen(char *pathname, int currentInode);
 int yfsRead(int inodeNum, void *buf, int size, int byteOffset, int pid);
 int yfsWrite(int inodeNum, void *buf, int size, int byteOffset, int pid);
+int readFileV(int inodeNum, struct IoVec *iov, int count, int byteOffset, int pid);
+int writeFileV(int inodeNum, struct IoVec *iov, int count, int byteOffset, int pid);
+int getIoVecFromProcess(struct IoVec *iov, int count, struct IoVec *localIov, int pid);
+int yfsReadV(int inodeNum, struct IoVec *iov, int count, int byteOffset, int pid);
+int yfsWriteV(int inodeNum, struct IoVec *iov, int count, int byteOffset, int pid);
 int yfsLink(char *oldName, char *newName, int currentInode);
 int yfsUnlink(char *pathname, int currentInode);
 int yfsSymLink(char *oldname, char *newname, int currentInode);
@@ -57,6 +241,10 @@ int yfsMkDir(char *pathname, int currentInode);
 int yfsRmDir(char *pathname, int currentInode);
 int yfsChDir(char *pathname, int currentInode);
 int yfsStat(char *pathname, int currentInode, struct Stat *statbuf, int pid);
+int yfsReadDir(int inodeNum, void *buf, int size, int cookie, int pid);
+int yfsLookup(char *pathname, int currentInode, int generation, struct message_reply *reply);
+void fillFileReply(int inodeNum, int generation, int current, struct message_reply *reply);
+bool isOpenInode(int inodeNum, int reuse);
 int yfsSync(void);
 int yfsShutdown(void);
 int yfsSeek(int inodeNum, int offset, int whence, int currentPosition);